@@ -0,0 +1,242 @@
+#ifndef BINARYPROTOCOL_H
+#define BINARYPROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Compact binary eBike reports, sent as an alternative to the JSON messages.
+//
+// Every message starts with a 4-byte header; multi-byte fields are
+// little-endian and doubles are IEEE 754:
+//
+//   offset  size  field
+//   0       1     magic (0xEB, never the first byte of a JSON message)
+//   1       1     protocol version (2; version 1, without sample times, is still accepted)
+//   2       1     message type
+//   3       1     status (position), action (maintenance) or count (batch)
+//
+// Position report (type 1, 24 bytes, or 32 with the sample time):
+//   4       4     eBike ID (int32)
+//   8       8     latitude (double)
+//   16      8     longitude (double)
+//   24      8     when the fix was taken, milliseconds since the epoch (int64, optional)
+//
+// Maintenance request (type 2, 8 bytes):
+//   4       4     eBike ID (int32)
+//
+// Position batch (type 3, 4 + count * 24 bytes), one record per report:
+//   0       4     eBike ID (int32)
+//   4       1     status
+//   5       3     reserved (zero)
+//   8       8     latitude (double)
+//   16      8     longitude (double)
+//
+// Timed position batch (type 4, version 2, 4 + count * 32 bytes): the
+// same records followed by when each fix was taken:
+//   24      8     milliseconds since the epoch (int64)
+namespace BinaryProtocol {
+
+const uint8_t Magic = 0xEB;
+const uint8_t Version = 2;
+const uint8_t MinVersion = 1; // Oldest version still accepted
+
+enum class MessageType : uint8_t {
+    Position = 1,
+    Maintenance = 2,
+    PositionBatch = 3,
+    TimedPositionBatch = 4
+};
+
+enum class MaintenanceAction : uint8_t {
+    Lock = 1,
+    Unlock = 2,
+    Remove = 3
+};
+
+const size_t HeaderSize = 4;
+const size_t PositionSize = 24;
+const size_t TimedPositionSize = 32;
+const size_t MaintenanceSize = 8;
+const size_t BatchRecordSize = 24;
+const size_t TimedBatchRecordSize = 32;
+const size_t MaxBatchCount = 255;
+const size_t MaxBatchSize = HeaderSize + MaxBatchCount * TimedBatchRecordSize;
+
+struct PositionReport {
+    int32_t id;
+    double lat;
+    double lon;
+    uint8_t status; // 0 = unlocked, 1 = locked
+    int64_t sampleMs = 0; // When the fix was taken, milliseconds since the epoch; 0 if not known
+};
+
+struct MaintenanceRequest {
+    int32_t id;
+    MaintenanceAction action;
+};
+
+inline void writeUint32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline void writeUint64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint32_t readUint32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline uint64_t readUint64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline void writeDouble(uint8_t* out, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    writeUint64(out, bits);
+}
+
+inline double readDouble(const uint8_t* in) {
+    uint64_t bits = readUint64(in);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Check whether a datagram is a binary message rather than JSON
+inline bool isBinary(const char* data, size_t length) {
+    return length >= HeaderSize && static_cast<uint8_t>(data[0]) == Magic;
+}
+
+// Message type of a binary message whose header has been validated
+inline MessageType messageType(const char* data) {
+    return static_cast<MessageType>(static_cast<uint8_t>(data[2]));
+}
+
+inline bool hasSupportedVersion(const char* data) {
+    uint8_t version = static_cast<uint8_t>(data[1]);
+    return version >= MinVersion && version <= Version;
+}
+
+// Encode a position report, with its sample time if known; the buffer
+// must hold TimedPositionSize bytes
+inline size_t encodePosition(uint8_t* out, const PositionReport& report) {
+    out[0] = Magic;
+    out[1] = Version;
+    out[2] = static_cast<uint8_t>(MessageType::Position);
+    out[3] = report.status;
+    writeUint32(out + 4, static_cast<uint32_t>(report.id));
+    writeDouble(out + 8, report.lat);
+    writeDouble(out + 16, report.lon);
+    if (report.sampleMs <= 0) {
+        return PositionSize;
+    }
+    writeUint64(out + 24, static_cast<uint64_t>(report.sampleMs));
+    return TimedPositionSize;
+}
+
+// Encode a maintenance request; the buffer must hold MaintenanceSize bytes
+inline size_t encodeMaintenance(uint8_t* out, const MaintenanceRequest& request) {
+    out[0] = Magic;
+    out[1] = Version;
+    out[2] = static_cast<uint8_t>(MessageType::Maintenance);
+    out[3] = static_cast<uint8_t>(request.action);
+    writeUint32(out + 4, static_cast<uint32_t>(request.id));
+    return MaintenanceSize;
+}
+
+// Encode up to MaxBatchCount position reports, as a timed batch if any
+// of them has a sample time; the buffer must hold
+// HeaderSize + count * TimedBatchRecordSize bytes
+inline size_t encodeBatch(uint8_t* out, const PositionReport* reports, size_t count) {
+    if (count > MaxBatchCount) {
+        count = MaxBatchCount;
+    }
+    bool timed = false;
+    for (size_t i = 0; i < count; ++i) {
+        timed = timed || reports[i].sampleMs > 0;
+    }
+    size_t recordSize = timed ? TimedBatchRecordSize : BatchRecordSize;
+    out[0] = Magic;
+    out[1] = Version;
+    out[2] = static_cast<uint8_t>(timed ? MessageType::TimedPositionBatch : MessageType::PositionBatch);
+    out[3] = static_cast<uint8_t>(count);
+
+    uint8_t* record = out + HeaderSize;
+    for (size_t i = 0; i < count; ++i, record += recordSize) {
+        writeUint32(record, static_cast<uint32_t>(reports[i].id));
+        record[4] = reports[i].status;
+        record[5] = record[6] = record[7] = 0;
+        writeDouble(record + 8, reports[i].lat);
+        writeDouble(record + 16, reports[i].lon);
+        if (timed) {
+            writeUint64(record + 24, static_cast<uint64_t>(reports[i].sampleMs));
+        }
+    }
+    return HeaderSize + count * recordSize;
+}
+
+// Size of each record of a plain or timed batch
+inline size_t batchRecordSize(const char* data) {
+    return messageType(data) == MessageType::TimedPositionBatch ? TimedBatchRecordSize : BatchRecordSize;
+}
+
+// Number of reports in a batch; returns false if the message is truncated
+inline bool batchCount(const char* data, size_t length, size_t& count) {
+    count = static_cast<uint8_t>(data[3]);
+    return length >= HeaderSize + count * batchRecordSize(data);
+}
+
+// Decode one report of a batch whose length has been validated
+inline void decodeBatchRecord(const char* data, size_t index, PositionReport& report) {
+    size_t recordSize = batchRecordSize(data);
+    const uint8_t* record = reinterpret_cast<const uint8_t*>(data) + HeaderSize + index * recordSize;
+    report.id = static_cast<int32_t>(readUint32(record));
+    report.status = record[4];
+    report.lat = readDouble(record + 8);
+    report.lon = readDouble(record + 16);
+    report.sampleMs = recordSize == TimedBatchRecordSize ? static_cast<int64_t>(readUint64(record + 24)) : 0;
+}
+
+// Decode a position report; returns false if the message is too short
+inline bool decodePosition(const char* data, size_t length, PositionReport& report) {
+    if (length < PositionSize) {
+        return false;
+    }
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+    report.status = in[3];
+    report.id = static_cast<int32_t>(readUint32(in + 4));
+    report.lat = readDouble(in + 8);
+    report.lon = readDouble(in + 16);
+    report.sampleMs = length >= TimedPositionSize ? static_cast<int64_t>(readUint64(in + 24)) : 0;
+    return true;
+}
+
+// Decode a maintenance request; returns false if the message is too short
+inline bool decodeMaintenance(const char* data, size_t length, MaintenanceRequest& request) {
+    if (length < MaintenanceSize) {
+        return false;
+    }
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+    request.action = static_cast<MaintenanceAction>(in[3]);
+    request.id = static_cast<int32_t>(readUint32(in + 4));
+    return true;
+}
+
+}
+
+#endif // BINARYPROTOCOL_H
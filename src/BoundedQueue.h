@@ -0,0 +1,134 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// BoundedQueue: Fixed-capacity lock-free queue for any number of producers
+// and consumers (Dmitry Vyukov's bounded MPMC queue). Each cell carries a
+// sequence number telling producers and consumers whose turn it is, so a
+// push or pop is one compare-and-swap on the tail or head plus one store.
+// Pushing to a full queue or popping from an empty one fails rather than
+// blocks; the caller decides what to do on overload.
+template <typename T>
+class BoundedQueue {
+public:
+    // The capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        _mask = size - 1;
+        _cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool tryPush(const T& value) {
+        Cell* cell;
+        size_t position = _tail.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[position & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // Full
+            } else {
+                position = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t position = _head.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[position & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // Empty
+            } else {
+                position = _head.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(position + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pop the oldest value only if keep(value) is false; returns false if
+    // the queue is empty or the oldest value is kept. The value is looked
+    // at before it is claimed, so this may only be called by the queue's
+    // one producer (nothing else may push while it runs).
+    template <typename Keep>
+    bool tryPopUnless(Keep keep, T& value) {
+        size_t position = _head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &_cells[position & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference < 0) {
+                return false; // Empty
+            }
+            if (difference > 0) {
+                position = _head.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (keep(cell->value)) {
+                return false;
+            }
+            if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                value = cell->value;
+                cell->sequence.store(position + _mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Approximate while other threads push or pop
+    size_t size() const {
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t tail = _tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _head{0}; // Next cell to pop
+    alignas(64) std::atomic<size_t> _tail{0}; // Next cell to push
+};
+
+#endif // BOUNDEDQUEUE_H
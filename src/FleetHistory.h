@@ -0,0 +1,355 @@
+#ifndef FLEETHISTORY_H
+#define FLEETHISTORY_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "FleetStore.h"
+#include "Numbers.h"
+#include "Metrics.h"
+
+// How much history FleetHistory keeps
+struct FleetHistoryOptions {
+    int64_t retentionSeconds = 24 * 60 * 60; // Points older than this are dropped
+    size_t maxPointsPerBike = 43200; // A day of reports every 2 seconds
+    size_t blockBytes = 512; // Compressed bytes per block before a new one is started
+    int64_t sweepSeconds = 60; // How often tracks that stopped growing are checked for expired points
+};
+
+// FleetHistory: The recent track of every eBike, kept in memory.
+//
+// Each bike's track is a ring of blocks. A block holds its first point in
+// full and every later point as the zigzag varint deltas of its time
+// (seconds) and coordinates (fixed point, 1e-6 degrees or about 0.1 m)
+// from the point before. A bike moving at cycling speed and reporting
+// every few seconds costs 5-7 bytes per point. The oldest block is
+// dropped once a track exceeds the point limit or the retention period;
+// tracks that stopped growing are swept for expired blocks periodically.
+// Consecutive reports at the same position are stored once, as a point
+// covering the time from the first to the last of them, so a parked bike
+// still shows up in any window it was parked through.
+//
+// History is fed by the fleet's change feed, sharded the same way as the
+// fleet, so recording a report only takes the shard's own lock.
+class FleetHistory : public FleetListener {
+public:
+    // One decoded point of a track, where the bike was reported from time
+    // until endTime (the same for a single report)
+    struct Point {
+        int64_t time;
+        int64_t endTime;
+        double lat;
+        double lon;
+    };
+
+    explicit FleetHistory(FleetStore& fleet, const FleetHistoryOptions& options = FleetHistoryOptions())
+        : _fleet(fleet), _options(options), _shards(fleet.shardCount()),
+          _points(Metrics::instance().gauge("gateway_history_points", "Track points held in memory")),
+          _bytes(Metrics::instance().gauge("gateway_history_bytes", "Memory used by track history")),
+          _running(true) {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _shards[i].reset(new Shard);
+        }
+        _fleet.addListener(this);
+        _sweepThread = std::thread(&FleetHistory::sweepLoop, this);
+    }
+
+    ~FleetHistory() {
+        {
+            std::lock_guard<std::mutex> lock(_sweepMutex);
+            _running = false;
+        }
+        _sweep.notify_all();
+        _sweepThread.join();
+        _fleet.removeListener(this);
+    }
+
+    FleetHistory(const FleetHistory&) = delete;
+    FleetHistory& operator=(const FleetHistory&) = delete;
+
+    // Points of an eBike's track that cover any time between two times
+    // (inclusive), oldest first; returns false if the bike has no history
+    bool track(int id, int64_t from, int64_t to, std::vector<Point>& points) const {
+        const Shard& shard = *_shards[_fleet.shardOf(id)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tracks.find(id);
+        if (it == shard.tracks.end()) {
+            return false;
+        }
+
+        for (const Block& block : it->second.blocks) {
+            if (block.lastEndTime < from || block.firstTime > to) {
+                continue;
+            }
+            block.decode([&](int64_t time, int64_t endTime, int32_t lat, int32_t lon) {
+                if (time <= to && endTime >= from) {
+                    points.push_back(Point{time, endTime, fromFixed(lat), fromFixed(lon)});
+                }
+            });
+        }
+        return true;
+    }
+
+    // Drop the points older than the retention period from every track,
+    // and the tracks left empty
+    void expire(int64_t now) {
+        for (auto& shardPtr : _shards) {
+            Shard& shard = *shardPtr;
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.tracks.begin(); it != shard.tracks.end();) {
+                Track& track = it->second;
+                dropExpired(track, now, 0);
+                if (track.blocks.empty()) {
+                    it = shard.tracks.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    // Serialize an eBike's track between two times as a GeoJSON Feature
+    // with a LineString geometry and, in its properties, the times of the
+    // first and last report at each point (seconds since the epoch);
+    // returns false if the bike has no history
+    bool toGeoJSON(int id, int64_t from, int64_t to, std::string& out) const {
+        std::vector<Point> points;
+        if (!track(id, from, to, points)) {
+            return false;
+        }
+
+        out.reserve(out.size() + 112 + points.size() * 60);
+        out += "{\"type\":\"Feature\",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[";
+        for (size_t i = 0; i < points.size(); ++i) {
+            out += i ? ",[" : "[";
+            Numbers::append(out, points[i].lon);
+            out += ',';
+            Numbers::append(out, points[i].lat);
+            out += ']';
+        }
+        out += "]},\"properties\":{\"id\":";
+        Numbers::append(out, id);
+        out += ",\"times\":[";
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (i) {
+                out += ',';
+            }
+            Numbers::append(out, points[i].time);
+        }
+        out += "],\"endTimes\":[";
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (i) {
+                out += ',';
+            }
+            Numbers::append(out, points[i].endTime);
+        }
+        out += "]}}";
+        return true;
+    }
+
+    // FleetListener, called with the fleet shard locked
+    void positionsApplied(size_t shardIndex, const PositionUpdate* updates, size_t count, int64_t now) override {
+        Shard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (size_t i = 0; i < count; ++i) {
+            append(shard.tracks[updates[i].id], now, toFixed(updates[i].lat), toFixed(updates[i].lon));
+        }
+    }
+
+    void removed(size_t shardIndex, int id) override {
+        Shard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tracks.find(id);
+        if (it == shard.tracks.end()) {
+            return;
+        }
+        while (!it->second.blocks.empty()) {
+            dropOldest(it->second);
+        }
+        shard.tracks.erase(it);
+    }
+
+private:
+    // A run of points: the first in full, the rest as deltas. Each later
+    // point is stored as how long the bike stayed at the point before,
+    // then its time from the end of that stay and its coordinates; the
+    // last point's stay is kept in full, as it grows with every repeat.
+    struct Block {
+        int64_t firstTime = 0;
+        int32_t firstLat = 0;
+        int32_t firstLon = 0;
+        int64_t lastTime = 0;
+        int64_t lastEndTime = 0;
+        int32_t lastLat = 0;
+        int32_t lastLon = 0;
+        uint32_t count = 0;
+        std::vector<uint8_t> deltas;
+
+        size_t memoryUsage() const {
+            return sizeof(Block) + deltas.capacity();
+        }
+
+        // Call visit(time, endTime, lat, lon) for every point, oldest first
+        template <typename Visitor>
+        void decode(Visitor visit) const {
+            if (count == 0) {
+                return;
+            }
+            int64_t time = firstTime;
+            int32_t lat = firstLat;
+            int32_t lon = firstLon;
+
+            const uint8_t* in = deltas.data();
+            for (uint32_t i = 1; i < count; ++i) {
+                int64_t endTime = time + readDelta(in);
+                visit(time, endTime, lat, lon);
+                time = endTime + readDelta(in);
+                lat += static_cast<int32_t>(readDelta(in));
+                lon += static_cast<int32_t>(readDelta(in));
+            }
+            visit(time, lastEndTime, lat, lon);
+        }
+    };
+
+    struct Track {
+        std::deque<Block> blocks;
+        size_t points = 0;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<int, Track> tracks;
+    };
+
+    FleetStore& _fleet;
+    FleetHistoryOptions _options;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    Gauge& _points;
+    Gauge& _bytes;
+    bool _running; // Guarded by _sweepMutex
+    std::mutex _sweepMutex;
+    std::condition_variable _sweep;
+    std::thread _sweepThread;
+
+    // Positions are validated on the way in; anything else is kept inside
+    // the globe so the conversion stays defined, with NaN at 0
+    static int32_t toFixed(double degrees) {
+        if (std::isnan(degrees)) {
+            return 0;
+        }
+        return static_cast<int32_t>(std::lround(std::max(-180.0, std::min(180.0, degrees)) * 1e6));
+    }
+
+    static double fromFixed(int32_t value) {
+        return static_cast<double>(value) / 1e6;
+    }
+
+    static void writeDelta(std::vector<uint8_t>& out, int64_t delta) {
+        uint64_t value = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    static int64_t readDelta(const uint8_t*& in) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            value |= static_cast<uint64_t>(*in++ & 0x7f) << shift;
+            shift += 7;
+        }
+        value |= static_cast<uint64_t>(*in++) << shift;
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    void append(Track& track, int64_t time, int32_t lat, int32_t lon) {
+        if (!track.blocks.empty()) {
+            Block& last = track.blocks.back();
+            if (last.lastLat == lat && last.lastLon == lon) {
+                last.lastEndTime = std::max(last.lastEndTime, time);
+                return;
+            }
+        }
+
+        if (track.blocks.empty() || track.blocks.back().deltas.size() >= _options.blockBytes) {
+            if (!track.blocks.empty()) {
+                // Sealed blocks never grow again
+                Block& sealed = track.blocks.back();
+                size_t before = sealed.memoryUsage();
+                sealed.deltas.shrink_to_fit();
+                _bytes.add(static_cast<int64_t>(sealed.memoryUsage()) - static_cast<int64_t>(before));
+            }
+            track.blocks.emplace_back();
+            Block& block = track.blocks.back();
+            block.firstTime = block.lastTime = block.lastEndTime = time;
+            block.firstLat = block.lastLat = lat;
+            block.firstLon = block.lastLon = lon;
+            block.count = 1;
+            _bytes.add(static_cast<int64_t>(block.memoryUsage()));
+        } else {
+            Block& block = track.blocks.back();
+            size_t before = block.deltas.capacity();
+            writeDelta(block.deltas, block.lastEndTime - block.lastTime);
+            writeDelta(block.deltas, time - block.lastEndTime);
+            writeDelta(block.deltas, static_cast<int64_t>(lat) - block.lastLat);
+            writeDelta(block.deltas, static_cast<int64_t>(lon) - block.lastLon);
+            block.lastTime = block.lastEndTime = time;
+            block.lastLat = lat;
+            block.lastLon = lon;
+            block.count++;
+            _bytes.add(static_cast<int64_t>(block.deltas.capacity() - before));
+        }
+        track.points++;
+        _points.add(1);
+
+        // Drop whole blocks once the track is too long or too old
+        while (track.blocks.size() > 1 && track.points - track.blocks.front().count >= _options.maxPointsPerBike) {
+            dropOldest(track);
+        }
+        dropExpired(track, time, 1);
+    }
+
+    // Drop the oldest blocks that ended before the retention period, but
+    // leave at least a number of blocks
+    void dropExpired(Track& track, int64_t now, size_t keep) {
+        while (track.blocks.size() > keep && track.blocks.front().lastEndTime < now - _options.retentionSeconds) {
+            dropOldest(track);
+        }
+    }
+
+    void dropOldest(Track& track) {
+        const Block& oldest = track.blocks.front();
+        track.points -= oldest.count;
+        _points.add(-static_cast<int64_t>(oldest.count));
+        _bytes.add(-static_cast<int64_t>(oldest.memoryUsage()));
+        track.blocks.pop_front();
+    }
+
+    // Sweep thread: tracks only expire on their own while they grow
+    void sweepLoop() {
+        std::unique_lock<std::mutex> lock(_sweepMutex);
+        while (_running) {
+            _sweep.wait_for(lock, std::chrono::seconds(_options.sweepSeconds));
+            if (!_running) {
+                break;
+            }
+            lock.unlock();
+            expire(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+            lock.lock();
+        }
+    }
+};
+
+#endif // FLEETHISTORY_H
@@ -0,0 +1,486 @@
+#ifndef FLEETJOURNAL_H
+#define FLEETJOURNAL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "FleetStore.h"
+#include "BinaryProtocol.h"
+#include "Logger.h"
+#include "hal/MappedFile.h"
+
+// How often FleetJournal commits and snapshots
+struct FleetJournalOptions {
+    std::chrono::milliseconds commitInterval{50}; // Longest a change waits to reach the disk
+    std::chrono::seconds snapshotInterval{300};
+    uint64_t snapshotAfterBytes = 256ull << 20; // Journal bytes that trigger an early snapshot
+};
+
+// FleetJournal: Keeps the fleet on disk so a restart does not lose it.
+//
+// Every change is appended as a fixed-size record to an in-memory buffer
+// per shard (the listener call is a 32-byte copy). A writer thread group
+// commits the buffers to the current journal segment with one write and
+// one fdatasync per commit interval, so a crash loses at most that
+// interval. A commit that fails is truncated away and retried whole, so a
+// segment only ever holds whole records in order. Periodically the writer
+// rotates to a new segment and hands the old ones to a snapshot thread,
+// which writes a compacted snapshot of the whole fleet and, once it is
+// safely on disk, deletes the older segments; commits carry on meanwhile.
+//
+// Files in the directory, numbered by a common sequence:
+//   journal-<seq>.log   changes, in order per bike
+//   snapshot-<seq>.bin  the fleet, including everything in journals < seq
+//
+// Records hold absolute state (a position, a status, a removal), so
+// replaying a change the snapshot already contains is harmless. Recovery
+// maps the latest snapshot, then replays the journals from its sequence
+// on; a torn record at the end of a journal is ignored.
+//
+// Record layout (32 bytes, little-endian):
+//   0   1  type (1 position, 2 status, 3 removal)
+//   1   1  status (0 unlocked, 1 locked)
+//   2   2  reserved (zero)
+//   4   4  eBike ID (int32)
+//   8   8  timestamp, seconds since the epoch (int64)
+//   16  8  latitude (double)
+//   24  8  longitude (double)
+//
+// A snapshot is a 16-byte header ("EBSNAP01" and a uint64 record count)
+// followed by one position record per eBike.
+class FleetJournal : public FleetListener {
+public:
+    static const size_t RecordSize = 32;
+
+    FleetJournal(FleetStore& fleet, const std::string& directory, const FleetJournalOptions& options = FleetJournalOptions())
+        : _fleet(fleet), _directory(directory), _options(options), _buffers(fleet.shardCount()) {
+        if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Failed to create journal directory: " + directory);
+        }
+        for (size_t i = 0; i < _buffers.size(); ++i) {
+            _buffers[i].reset(new ShardBuffer);
+        }
+    }
+
+    ~FleetJournal() {
+        stop();
+    }
+
+    FleetJournal(const FleetJournal&) = delete;
+    FleetJournal& operator=(const FleetJournal&) = delete;
+
+    // Rebuild the fleet from the latest snapshot and the journals after it;
+    // returns the number of records applied. Call before start().
+    size_t recover() {
+        std::vector<uint64_t> snapshots = listFiles("snapshot-", ".bin");
+        std::vector<uint64_t> journals = listFiles("journal-", ".log");
+
+        size_t applied = 0;
+        uint64_t snapshotSequence = 0;
+        if (!snapshots.empty()) {
+            snapshotSequence = snapshots.back();
+            applied += loadSnapshot(path("snapshot-", snapshotSequence, ".bin"));
+        }
+        for (uint64_t sequence : journals) {
+            if (sequence >= snapshotSequence) {
+                applied += replay(path("journal-", sequence, ".log"));
+            }
+        }
+
+        // Never append to a journal that may end in a torn record
+        uint64_t last = snapshotSequence;
+        if (!journals.empty()) {
+            last = std::max(last, journals.back());
+        }
+        _sequence = last + 1;
+        return applied;
+    }
+
+    // Start journaling every change to the fleet
+    void start() {
+        if (_running.exchange(true)) {
+            return;
+        }
+        if (_sequence == 0) {
+            _sequence = 1;
+        }
+
+        // Snapshots a crash left half written
+        for (uint64_t sequence : listFiles("snapshot-", ".bin.tmp")) {
+            ::unlink((path("snapshot-", sequence, ".bin") + ".tmp").c_str());
+        }
+
+        _fd = openSegment(_sequence);
+        _segmentBytes = 0;
+        _lastSnapshot = std::chrono::steady_clock::now();
+        _fleet.addListener(this);
+        _writerThread = std::thread(&FleetJournal::writerLoop, this);
+    }
+
+    // Commit everything journaled so far and stop
+    void stop() {
+        if (!_running.exchange(false)) {
+            return;
+        }
+        _fleet.removeListener(this);
+        {
+            std::lock_guard<std::mutex> lock(_wakeMutex);
+        }
+        _wake.notify_one();
+        if (_writerThread.joinable()) {
+            _writerThread.join();
+        }
+        if (_snapshotThread.joinable()) {
+            _snapshotThread.join();
+        }
+        try {
+            commit();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Fleet journal error: " << e.what());
+        }
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    // FleetListener, called with the shard locked
+    void positionsApplied(size_t shard, const PositionUpdate* updates, size_t count, int64_t now) override {
+        ShardBuffer& buffer = *_buffers[shard];
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        size_t offset = buffer.bytes.size();
+        buffer.bytes.resize(offset + count * RecordSize);
+        for (size_t i = 0; i < count; ++i) {
+            encodeRecord(&buffer.bytes[offset + i * RecordSize], RecordType::Position, updates[i].id,
+                updates[i].status, now, updates[i].lat, updates[i].lon);
+        }
+    }
+
+    void statusChanged(size_t shard, int id, EBikeStatus status, int64_t now) override {
+        append(shard, RecordType::Status, id, status, now, 0, 0);
+    }
+
+    void removed(size_t shard, int id) override {
+        append(shard, RecordType::Removal, id, EBikeStatus::Unlocked, 0, 0, 0);
+    }
+
+private:
+    enum class RecordType : uint8_t {
+        Position = 1,
+        Status = 2,
+        Removal = 3
+    };
+
+    struct ShardBuffer {
+        std::mutex mutex;
+        std::vector<uint8_t> bytes; // Records not yet written
+    };
+
+    FleetStore& _fleet;
+    std::string _directory;
+    FleetJournalOptions _options;
+    std::vector<std::unique_ptr<ShardBuffer>> _buffers;
+    std::atomic<bool> _running{false};
+    std::thread _writerThread;
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+    std::thread _snapshotThread; // Started by the writer thread, one snapshot at a time
+    std::atomic<bool> _snapshotting{false};
+
+    // Writer thread only, after start()
+    uint64_t _sequence = 0; // Current journal segment
+    int _fd = -1;
+    uint64_t _segmentBytes = 0; // Committed to the current segment
+    std::chrono::steady_clock::time_point _lastSnapshot;
+    std::vector<std::vector<uint8_t>> _pendingWrites; // Per shard, in order; kept until committed
+
+    static void encodeRecord(uint8_t* out, RecordType type, int id, EBikeStatus status, int64_t timestamp,
+                             double lat, double lon) {
+        out[0] = static_cast<uint8_t>(type);
+        out[1] = static_cast<uint8_t>(status);
+        out[2] = out[3] = 0;
+        BinaryProtocol::writeUint32(out + 4, static_cast<uint32_t>(id));
+        BinaryProtocol::writeUint64(out + 8, static_cast<uint64_t>(timestamp));
+        BinaryProtocol::writeDouble(out + 16, lat);
+        BinaryProtocol::writeDouble(out + 24, lon);
+    }
+
+    void append(size_t shard, RecordType type, int id, EBikeStatus status, int64_t now, double lat, double lon) {
+        ShardBuffer& buffer = *_buffers[shard];
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        size_t offset = buffer.bytes.size();
+        buffer.bytes.resize(offset + RecordSize);
+        encodeRecord(&buffer.bytes[offset], type, id, status, now, lat, lon);
+    }
+
+    // Apply one record to the fleet; returns false if it is not a valid record
+    bool applyRecord(const uint8_t* record) {
+        int id = static_cast<int>(BinaryProtocol::readUint32(record + 4));
+        EBikeStatus status = record[1] ? EBikeStatus::Locked : EBikeStatus::Unlocked;
+        int64_t timestamp = static_cast<int64_t>(BinaryProtocol::readUint64(record + 8));
+
+        switch (static_cast<RecordType>(record[0])) {
+        case RecordType::Position:
+            _fleet.restorePosition(id, BinaryProtocol::readDouble(record + 16),
+                BinaryProtocol::readDouble(record + 24), status, timestamp);
+            return true;
+        case RecordType::Status:
+            _fleet.restoreStatus(id, status, timestamp);
+            return true;
+        case RecordType::Removal:
+            _fleet.restoreRemoval(id);
+            return true;
+        }
+        return false;
+    }
+
+    size_t loadSnapshot(const std::string& filePath) {
+        MappedFile file(filePath);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(file.data());
+        if (file.size() < 16 || std::memcmp(data, "EBSNAP01", 8) != 0) {
+            LOG_WARNING("Ignoring invalid fleet snapshot " << filePath);
+            return 0;
+        }
+
+        uint64_t count = BinaryProtocol::readUint64(data + 8);
+        count = std::min<uint64_t>(count, (file.size() - 16) / RecordSize);
+        _fleet.reserve(static_cast<size_t>(count));
+
+        const uint8_t* record = data + 16;
+        for (uint64_t i = 0; i < count; ++i, record += RecordSize) {
+            applyRecord(record);
+        }
+        return static_cast<size_t>(count);
+    }
+
+    size_t replay(const std::string& filePath) {
+        MappedFile file(filePath);
+        const uint8_t* record = reinterpret_cast<const uint8_t*>(file.data());
+        size_t count = file.size() / RecordSize;
+        for (size_t i = 0; i < count; ++i, record += RecordSize) {
+            if (!applyRecord(record)) {
+                LOG_WARNING("Stopped replaying " << filePath << " at an invalid record " << i);
+                return i;
+            }
+        }
+        return count;
+    }
+
+    std::string path(const char* prefix, uint64_t sequence, const char* suffix) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s%020llu%s", prefix, static_cast<unsigned long long>(sequence), suffix);
+        return _directory + "/" + name;
+    }
+
+    // Sequence numbers of the files named <prefix><seq><suffix>, ascending
+    std::vector<uint64_t> listFiles(const std::string& prefix, const std::string& suffix) const {
+        std::vector<uint64_t> sequences;
+        DIR* dir = ::opendir(_directory.c_str());
+        if (!dir) {
+            return sequences;
+        }
+        while (struct dirent* entry = ::readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > prefix.size() + suffix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                sequences.push_back(std::strtoull(name.c_str() + prefix.size(), nullptr, 10));
+            }
+        }
+        ::closedir(dir);
+        std::sort(sequences.begin(), sequences.end());
+        return sequences;
+    }
+
+    int openSegment(uint64_t sequence) const {
+        std::string filePath = path("journal-", sequence, ".log");
+        int fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open journal: " + filePath);
+        }
+        return fd;
+    }
+
+    static void writeAll(int fd, const uint8_t* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Journal write failed: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    // Write every buffered record to the current segment and sync it. If
+    // that fails, whatever reached the segment is truncated away and the
+    // records are kept, ahead of any newer ones, for the next commit.
+    void commit() {
+        _pendingWrites.resize(_buffers.size());
+        size_t total = 0;
+        for (size_t i = 0; i < _buffers.size(); ++i) {
+            std::vector<uint8_t>& pending = _pendingWrites[i];
+            {
+                std::lock_guard<std::mutex> lock(_buffers[i]->mutex);
+                std::vector<uint8_t>& bytes = _buffers[i]->bytes;
+                if (pending.empty()) {
+                    pending.swap(bytes);
+                } else {
+                    pending.insert(pending.end(), bytes.begin(), bytes.end());
+                    bytes.clear();
+                }
+            }
+            total += pending.size();
+        }
+        if (total == 0 || _fd < 0) {
+            return;
+        }
+
+        try {
+            for (const std::vector<uint8_t>& bytes : _pendingWrites) {
+                writeAll(_fd, bytes.data(), bytes.size());
+            }
+            if (::fdatasync(_fd) != 0) {
+                throw std::runtime_error(std::string("Journal sync failed: ") + std::strerror(errno));
+            }
+        } catch (...) {
+            if (::ftruncate(_fd, static_cast<off_t>(_segmentBytes)) != 0) {
+                LOG_ERROR("Failed to truncate journal " << _sequence << ": " << std::strerror(errno));
+            }
+            throw;
+        }
+        for (std::vector<uint8_t>& bytes : _pendingWrites) {
+            bytes.clear();
+        }
+        _segmentBytes += total;
+    }
+
+    // Commit and move on to a new segment; returns the new sequence, which
+    // a snapshot taken from now on covers everything before
+    uint64_t rotate() {
+        commit();
+        int fd = openSegment(_sequence + 1);
+        ::close(_fd);
+        _fd = fd;
+        _segmentBytes = 0;
+        return ++_sequence;
+    }
+
+    // Write the fleet as seen after a rotation to a snapshot and, once it
+    // is on disk, delete everything it makes redundant
+    void snapshot(uint64_t sequence) {
+        std::vector<uint8_t> bytes(16);
+        std::memcpy(bytes.data(), "EBSNAP01", 8);
+        uint64_t count = 0;
+        for (size_t shard = 0; shard < _fleet.shardCount(); ++shard) {
+            _fleet.forEachInShard(shard, [&](int id, double lat, double lon, EBikeStatus status, int64_t timestamp) {
+                size_t offset = bytes.size();
+                bytes.resize(offset + RecordSize);
+                encodeRecord(&bytes[offset], RecordType::Position, id, status, timestamp, lat, lon);
+                count++;
+            });
+        }
+        BinaryProtocol::writeUint64(&bytes[8], count);
+
+        std::string finalPath = path("snapshot-", sequence, ".bin");
+        std::string tempPath = finalPath + ".tmp";
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create snapshot: " + tempPath);
+        }
+        try {
+            writeAll(fd, bytes.data(), bytes.size());
+            if (::fsync(fd) != 0) {
+                throw std::runtime_error(std::string("Snapshot sync failed: ") + std::strerror(errno));
+            }
+        } catch (...) {
+            ::close(fd);
+            ::unlink(tempPath.c_str());
+            throw;
+        }
+        ::close(fd);
+        if (::rename(tempPath.c_str(), finalPath.c_str()) != 0) {
+            ::unlink(tempPath.c_str());
+            throw std::runtime_error("Failed to install snapshot: " + finalPath);
+        }
+
+        // The older files are only deleted once the rename is durable
+        int dirFd = ::open(_directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd < 0) {
+            throw std::runtime_error("Failed to open journal directory: " + _directory);
+        }
+        int synced = ::fsync(dirFd);
+        ::close(dirFd);
+        if (synced != 0) {
+            throw std::runtime_error(std::string("Journal directory sync failed: ") + std::strerror(errno));
+        }
+
+        for (uint64_t old : listFiles("journal-", ".log")) {
+            if (old < sequence) {
+                ::unlink(path("journal-", old, ".log").c_str());
+            }
+        }
+        for (uint64_t old : listFiles("snapshot-", ".bin")) {
+            if (old < sequence) {
+                ::unlink(path("snapshot-", old, ".bin").c_str());
+            }
+        }
+        LOG_INFO("Wrote fleet snapshot of " << count << " eBikes");
+    }
+
+    void writerLoop() {
+        while (_running.load()) {
+            {
+                std::unique_lock<std::mutex> lock(_wakeMutex);
+                _wake.wait_for(lock, _options.commitInterval, [this] { return !_running.load(); });
+            }
+
+            try {
+                commit();
+                bool due = std::chrono::steady_clock::now() - _lastSnapshot >= _options.snapshotInterval;
+                if ((_segmentBytes >= _options.snapshotAfterBytes || (due && _segmentBytes > 0)) &&
+                    !_snapshotting.load()) {
+                    uint64_t sequence = rotate();
+                    _lastSnapshot = std::chrono::steady_clock::now();
+                    if (_snapshotThread.joinable()) {
+                        _snapshotThread.join();
+                    }
+                    _snapshotting = true;
+                    _snapshotThread = std::thread(&FleetJournal::snapshotLoop, this, sequence);
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR("Fleet journal error: " << e.what());
+            }
+        }
+    }
+
+    // Snapshot thread: serializing the fleet takes too long to hold up commits
+    void snapshotLoop(uint64_t sequence) {
+        try {
+            snapshot(sequence);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Fleet snapshot error: " << e.what());
+        }
+        _snapshotting = false;
+    }
+};
+
+#endif // FLEETJOURNAL_H
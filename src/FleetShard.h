@@ -0,0 +1,600 @@
+#ifndef FLEETSHARD_H
+#define FLEETSHARD_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "Numbers.h"
+
+// Lock status of an eBike
+enum class EBikeStatus : uint8_t {
+    Unlocked = 0,
+    Locked = 1
+};
+
+inline const char* statusToString(EBikeStatus status) {
+    return status == EBikeStatus::Locked ? "locked" : "unlocked";
+}
+
+inline EBikeStatus statusFromString(const std::string& status) {
+    return status == "locked" ? EBikeStatus::Locked : EBikeStatus::Unlocked;
+}
+
+// A position report for one eBike
+struct PositionUpdate {
+    int id;
+    double lat;
+    double lon;
+    EBikeStatus status;
+    int64_t sampleMs = 0; // When the bike took the fix, milliseconds since the epoch; 0 if not reported
+};
+
+// Whether a latitude and longitude name a point on the globe; false for
+// NaN, infinities and anything outside ±90 and ±180 degrees
+inline bool isValidPosition(double lat, double lon) {
+    return lat >= -90 && lat <= 90 && lon >= -180 && lon <= 180;
+}
+
+// Restricts fleet queries to a bounding box and/or a status
+struct FleetFilter {
+    bool hasBox = false;
+    double minLon = 0, minLat = 0, maxLon = 0, maxLat = 0;
+    bool hasStatus = false;
+    EBikeStatus status = EBikeStatus::Unlocked;
+
+    bool isEmpty() const {
+        return !hasBox && !hasStatus;
+    }
+
+    bool matches(double lat, double lon, EBikeStatus bikeStatus) const {
+        if (hasStatus && bikeStatus != status) {
+            return false;
+        }
+        return !hasBox || (lon >= minLon && lon <= maxLon && lat >= minLat && lat <= maxLat);
+    }
+};
+
+// Formats timestamps as "%Y-%m-%d %H:%M:%S", reusing the last result
+// since updates arriving within the same second share a timestamp
+struct TimestampCache {
+    int64_t seconds = -1;
+    char text[26] = {0};
+
+    const char* format(int64_t value) {
+        if (value != seconds) {
+            std::time_t t = static_cast<std::time_t>(value);
+            std::tm tmBuffer;
+            localtime_r(&t, &tmBuffer);
+            strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tmBuffer);
+            seconds = value;
+        }
+        return text;
+    }
+};
+
+// FleetDelta: The eBikes changed or removed after a fleet version, with
+// their state at the later version and every state they passed through on
+// the way. It is collected with the shards locked and can then be rendered
+// through any filter without them: a bike that no longer matches is
+// reported as removed only if a viewer of that filter could hold it, i.e.
+// if it matched at the earlier version or, for viewers that are somewhere
+// between the two versions, at any point in between.
+struct FleetDelta {
+    struct State {
+        double lat;
+        double lon;
+        EBikeStatus status;
+    };
+
+    struct Entry {
+        int id;
+        bool present; // Still in the fleet at the later version
+        bool existedBefore; // In the fleet at the earlier version, as the first earlier state
+        State state; // At the later version, if present
+        uint32_t firstEarlier; // States it had from the earlier version on, in earlier
+        uint32_t earlierCount;
+        uint32_t featureOffset; // Its GeoJSON feature, in features, if present
+        uint32_t featureLength;
+    };
+
+    uint64_t since = 0;
+    uint64_t version = 0;
+    std::vector<Entry> entries;
+    std::vector<State> earlier;
+    std::string features;
+
+    // Append the features matching a filter, comma-separated
+    void appendFeatures(std::string& out, const FleetFilter& filter, bool& first) const {
+        for (const Entry& entry : entries) {
+            if (!entry.present || !filter.matches(entry.state.lat, entry.state.lon, entry.state.status)) {
+                continue;
+            }
+            if (!first) {
+                out += ',';
+            }
+            out.append(features, entry.featureOffset, entry.featureLength);
+            first = false;
+        }
+    }
+
+    // Append the IDs a viewer of a filter may hold that it should drop,
+    // comma-separated. A viewer at the earlier version (exact) only drops
+    // what it held then; a viewer somewhere in between drops anything it
+    // may have picked up since.
+    void appendRemoved(std::string& out, const FleetFilter& filter, bool exact, bool& first) const {
+        for (const Entry& entry : entries) {
+            if (entry.present && filter.matches(entry.state.lat, entry.state.lon, entry.state.status)) {
+                continue;
+            }
+            uint32_t end = entry.firstEarlier + (exact ? entry.existedBefore : entry.earlierCount);
+            bool held = false;
+            for (uint32_t i = entry.firstEarlier; i < end && !held; ++i) {
+                held = filter.matches(earlier[i].lat, earlier[i].lon, earlier[i].status);
+            }
+            if (!held) {
+                continue;
+            }
+            if (!first) {
+                out += ',';
+            }
+            Numbers::append(out, entry.id);
+            first = false;
+        }
+    }
+};
+
+// FleetShard: The records of the eBikes whose IDs map to one shard.
+// Records are kept as parallel arrays (struct-of-arrays) so updates touch
+// only plain fields and serialization walks contiguous memory. Positions
+// are also bucketed in a uniform lat/lon grid, maintained as bikes move,
+// so bounding-box queries only visit the cells they overlap.
+//
+// Every change stamps the record with the next value of the fleet-wide
+// version counter and is appended, with the bike's state before it, to a
+// change log in version order, so a delta query only visits the records
+// changed since its version. A batch takes its versions from the counter
+// in one block, so workers applying batches to different shards only
+// touch the shared counter once per batch. Each record also keeps when
+// its last position report arrived and the velocity between its last two
+// reports, the estimate bikes reporting by dead reckoning expect the
+// gateway to extrapolate with. The velocity is taken over the times the bike says it took the
+// fixes, since reports delayed or buffered on the way would turn arrival
+// times into absurd speeds; bikes that do not say have none. A report of
+// a fix older than the one already applied arrived out of order and only
+// counts as the bike being seen. The caller holds the shard's mutex for
+// every call.
+class FleetShard {
+public:
+    // Changes remembered for delta queries: this many plus a few per bike.
+    // Older ones force a full resync.
+    static constexpr size_t MinChangeLog = 4096;
+    static constexpr size_t ChangeLogPerBike = 4;
+
+    // Grid cell size in degrees (about 1 km of latitude)
+    static constexpr double CellSize = 0.01;
+
+    mutable std::mutex mutex;
+
+    FleetShard(std::atomic<uint64_t>& version) : _version(version), _changeHorizon(version.load()) {}
+
+    FleetShard(const FleetShard&) = delete;
+    FleetShard& operator=(const FleetShard&) = delete;
+
+    // Versions for up to count changes, taken from the fleet counter at
+    // once and handed out in order while the block is alive; any left
+    // over are skipped. Held with the shard locked, so nobody can read the
+    // fleet version between the block being taken and its changes made.
+    class VersionBlock {
+    public:
+        VersionBlock(FleetShard& shard, size_t count) : _shard(shard) {
+            uint64_t first = shard._version.fetch_add(count, std::memory_order_release) + 1;
+            shard._blockNext = first;
+            shard._blockEnd = first + count;
+        }
+
+        ~VersionBlock() {
+            _shard._blockNext = _shard._blockEnd = 0;
+        }
+
+        VersionBlock(const VersionBlock&) = delete;
+        VersionBlock& operator=(const VersionBlock&) = delete;
+
+    private:
+        FleetShard& _shard;
+    };
+
+    // Insert or update one record from a report seen at seenMs, of a fix
+    // taken at sampleMs (milliseconds since the epoch, 0 if not reported).
+    // Returns false if the fix is older than the record's, which is left
+    // as it is.
+    bool applyPosition(int id, double lat, double lon, EBikeStatus status, int64_t now, int64_t seenMs,
+                       int64_t sampleMs) {
+        auto it = _index.find(id);
+        if (it == _index.end()) {
+            _index.emplace(id, static_cast<uint32_t>(_ids.size()));
+            _ids.push_back(id);
+            _lats.push_back(lat);
+            _lons.push_back(lon);
+            _status.push_back(status);
+            _timestamps.push_back(now);
+            _lastSeen.push_back(seenMs);
+            _sampleTimes.push_back(sampleMs);
+            _velocityLats.push_back(0);
+            _velocityLons.push_back(0);
+            _changes.push_back(0);
+            _cells.push_back(0);
+            _cellPositions.push_back(0);
+            addToCell(static_cast<uint32_t>(_ids.size() - 1), cellKey(lat, lon));
+            logChange(static_cast<uint32_t>(_ids.size() - 1), Change{id, false, EBikeStatus::Unlocked, 0, 0, 0});
+            return true;
+        }
+
+        uint32_t slot = it->second;
+        if (sampleMs > 0 && sampleMs < _sampleTimes[slot]) {
+            _lastSeen[slot] = std::max(_lastSeen[slot], seenMs);
+            return false;
+        }
+        Change change = changeOf(slot);
+        if (sampleMs <= 0 || _sampleTimes[slot] <= 0) {
+            _velocityLats[slot] = 0;
+            _velocityLons[slot] = 0;
+        } else if (sampleMs > _sampleTimes[slot]) {
+            double elapsed = (sampleMs - _sampleTimes[slot]) / 1000.0;
+            _velocityLats[slot] = (lat - _lats[slot]) / elapsed;
+            _velocityLons[slot] = (lon - _lons[slot]) / elapsed;
+        }
+        _sampleTimes[slot] = sampleMs;
+        _lats[slot] = lat;
+        _lons[slot] = lon;
+        _status[slot] = status;
+        _timestamps[slot] = now;
+        _lastSeen[slot] = std::max(_lastSeen[slot], seenMs);
+        logChange(slot, change);
+
+        int64_t cell = cellKey(lat, lon);
+        if (cell != _cells[slot]) {
+            removeFromCell(slot);
+            addToCell(slot, cell);
+        }
+        return true;
+    }
+
+    // Update the status of a known eBike; returns false if the ID is unknown
+    bool updateStatus(int id, EBikeStatus status, int64_t now) {
+        auto it = _index.find(id);
+        if (it == _index.end()) {
+            return false;
+        }
+
+        Change change = changeOf(it->second);
+        _status[it->second] = status;
+        _timestamps[it->second] = now;
+        logChange(it->second, change);
+        return true;
+    }
+
+    // Remove an eBike; returns false if the ID is unknown
+    bool remove(int id) {
+        auto it = _index.find(id);
+        if (it == _index.end()) {
+            return false;
+        }
+
+        // Move the last record into the freed slot
+        uint32_t slot = it->second;
+        Change change = changeOf(slot);
+        uint32_t last = static_cast<uint32_t>(_ids.size() - 1);
+        removeFromCell(slot);
+        if (slot != last) {
+            _ids[slot] = _ids[last];
+            _lats[slot] = _lats[last];
+            _lons[slot] = _lons[last];
+            _status[slot] = _status[last];
+            _timestamps[slot] = _timestamps[last];
+            _lastSeen[slot] = _lastSeen[last];
+            _sampleTimes[slot] = _sampleTimes[last];
+            _velocityLats[slot] = _velocityLats[last];
+            _velocityLons[slot] = _velocityLons[last];
+            _changes[slot] = _changes[last];
+            _cells[slot] = _cells[last];
+            _cellPositions[slot] = _cellPositions[last];
+            _grid[_cells[slot]][_cellPositions[slot]] = slot;
+            _index[_ids[slot]] = slot;
+        }
+        _index.erase(it);
+        _ids.pop_back();
+        _lats.pop_back();
+        _lons.pop_back();
+        _status.pop_back();
+        _timestamps.pop_back();
+        _lastSeen.pop_back();
+        _sampleTimes.pop_back();
+        _velocityLats.pop_back();
+        _velocityLons.pop_back();
+        _changes.pop_back();
+        _cells.pop_back();
+        _cellPositions.pop_back();
+
+        change.version = nextVersion();
+        appendToLog(change);
+        return true;
+    }
+
+    size_t size() const {
+        return _ids.size();
+    }
+
+    // Make room for a number of records
+    void reserve(size_t count) {
+        _index.reserve(count);
+        _ids.reserve(count);
+        _lats.reserve(count);
+        _lons.reserve(count);
+        _status.reserve(count);
+        _timestamps.reserve(count);
+        _lastSeen.reserve(count);
+        _sampleTimes.reserve(count);
+        _velocityLats.reserve(count);
+        _velocityLons.reserve(count);
+        _changes.reserve(count);
+        _cells.reserve(count);
+        _cellPositions.reserve(count);
+    }
+
+    // Call visit(id, lat, lon, status, timestamp) for every record
+    template <typename Visitor>
+    void forEach(Visitor& visit) const {
+        for (size_t i = 0; i < _ids.size(); ++i) {
+            visit(_ids[i], _lats[i], _lons[i], _status[i], _timestamps[i]);
+        }
+    }
+
+    // Changes at or before this version are no longer known
+    uint64_t changeHorizon() const {
+        return _changeHorizon;
+    }
+
+    // Append the features matching a filter. Bounding-box queries walk
+    // only the grid cells overlapping the box.
+    void appendFeatures(std::string& out, const FleetFilter& filter, bool& first, TimestampCache& timeCache) const {
+        auto append = [&](uint32_t slot) {
+            if (!filter.matches(_lats[slot], _lons[slot], _status[slot])) {
+                return;
+            }
+            if (!first) {
+                out += ',';
+            }
+            appendFeature(out, slot, timeCache);
+            first = false;
+        };
+
+        if (filter.hasBox) {
+            forEachInBox(filter, append);
+        } else {
+            for (uint32_t slot = 0; slot < _ids.size(); ++slot) {
+                append(slot);
+            }
+        }
+    }
+
+    // Add the bikes changed or removed after a version to a delta. Only the
+    // change log after the version is walked.
+    void collectChanges(uint64_t since, FleetDelta& delta, TimestampCache& timeCache) const {
+        auto start = std::upper_bound(_changeLog.begin(), _changeLog.end(), since,
+            [](uint64_t version, const Change& change) { return version < change.version; });
+        if (start == _changeLog.end()) {
+            return;
+        }
+
+        // One entry per bike, with the state before each of its changes
+        size_t firstEntry = delta.entries.size();
+        std::unordered_map<int, uint32_t> entryOf;
+        std::vector<std::pair<uint32_t, FleetDelta::State>> earlier;
+        for (auto change = start; change != _changeLog.end(); ++change) {
+            auto found = entryOf.emplace(change->id, static_cast<uint32_t>(delta.entries.size()));
+            if (found.second) {
+                FleetDelta::Entry entry = {};
+                entry.id = change->id;
+                entry.existedBefore = change->existed;
+                delta.entries.push_back(entry);
+            }
+            if (change->existed) {
+                earlier.emplace_back(found.first->second, FleetDelta::State{change->lat, change->lon, change->status});
+            }
+        }
+
+        std::stable_sort(earlier.begin(), earlier.end(),
+            [](const std::pair<uint32_t, FleetDelta::State>& a, const std::pair<uint32_t, FleetDelta::State>& b) {
+                return a.first < b.first;
+            });
+        size_t next = 0;
+        for (size_t e = firstEntry; e < delta.entries.size(); ++e) {
+            FleetDelta::Entry& entry = delta.entries[e];
+            entry.firstEarlier = static_cast<uint32_t>(delta.earlier.size());
+            for (; next < earlier.size() && earlier[next].first == e; ++next) {
+                delta.earlier.push_back(earlier[next].second);
+            }
+            entry.earlierCount = static_cast<uint32_t>(delta.earlier.size()) - entry.firstEarlier;
+
+            auto it = _index.find(entry.id);
+            if (it == _index.end()) {
+                continue;
+            }
+            uint32_t slot = it->second;
+            entry.present = true;
+            entry.state = FleetDelta::State{_lats[slot], _lons[slot], _status[slot]};
+            entry.featureOffset = static_cast<uint32_t>(delta.features.size());
+            appendFeature(delta.features, slot, timeCache);
+            entry.featureLength = static_cast<uint32_t>(delta.features.size()) - entry.featureOffset;
+        }
+    }
+
+private:
+    std::atomic<uint64_t>& _version; // Fleet-wide version counter
+    std::unordered_map<int, uint32_t> _index; // Bike ID -> slot in the arrays below
+    std::vector<int> _ids;
+    std::vector<double> _lats;
+    std::vector<double> _lons;
+    std::vector<EBikeStatus> _status;
+    std::vector<int64_t> _timestamps; // Seconds since the epoch
+    std::vector<int64_t> _lastSeen; // Milliseconds since the epoch of the last position report
+    std::vector<int64_t> _sampleTimes; // When the last reported fix was taken, as the bike said; 0 if not
+    std::vector<double> _velocityLats; // Degrees per second between the last two reported fixes
+    std::vector<double> _velocityLons;
+    std::vector<uint64_t> _changes; // Fleet version of each record's last change
+    std::vector<int64_t> _cells; // Grid cell of each record
+    std::vector<uint32_t> _cellPositions; // Position of each record in its cell's bucket
+    std::unordered_map<int64_t, std::vector<uint32_t>> _grid; // Grid cell -> slots
+
+    // A change to one bike, with the bike's state before it
+    struct Change {
+        int id;
+        bool existed; // Whether the bike was in the fleet before the change
+        EBikeStatus status;
+        double lat;
+        double lon;
+        uint64_t version;
+    };
+    std::deque<Change> _changeLog; // Most recent changes, oldest first
+    uint64_t _changeHorizon; // Changes at or before this version are forgotten
+    uint64_t _blockNext = 0; // Next unused version of the current VersionBlock, if any
+    uint64_t _blockEnd = 0;
+
+    uint64_t nextVersion() {
+        if (_blockNext < _blockEnd) {
+            return _blockNext++;
+        }
+        return _version.fetch_add(1, std::memory_order_release) + 1;
+    }
+
+    // A change to a record, before it is made
+    Change changeOf(uint32_t slot) const {
+        return Change{_ids[slot], true, _status[slot], _lats[slot], _lons[slot], 0};
+    }
+
+    // Stamp a record with the next version and log the change
+    void logChange(uint32_t slot, Change change) {
+        _changes[slot] = change.version = nextVersion();
+        appendToLog(change);
+    }
+
+    // Versions are taken under the shard lock, so the log stays in version order
+    void appendToLog(const Change& change) {
+        _changeLog.push_back(change);
+        while (_changeLog.size() > MinChangeLog + ChangeLogPerBike * _ids.size()) {
+            _changeHorizon = _changeLog.front().version;
+            _changeLog.pop_front();
+        }
+    }
+
+    // Positions are validated on the way in, but the cast is kept defined
+    // for any value: NaN lands in cell 0 and anything beyond the globe in
+    // the cells at its edge
+    static int32_t cellCoordinate(double degrees) {
+        const double maxCell = 180 / CellSize + 1;
+        double cell = std::floor(degrees / CellSize);
+        if (std::isnan(cell)) {
+            return 0;
+        }
+        return static_cast<int32_t>(std::max(-maxCell, std::min(maxCell, cell)));
+    }
+
+    static int64_t cellKey(int32_t row, int32_t column) {
+        return static_cast<int64_t>((static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) |
+            static_cast<uint32_t>(column));
+    }
+
+    static int64_t cellKey(double lat, double lon) {
+        return cellKey(cellCoordinate(lat), cellCoordinate(lon));
+    }
+
+    void addToCell(uint32_t slot, int64_t cell) {
+        std::vector<uint32_t>& bucket = _grid[cell];
+        _cells[slot] = cell;
+        _cellPositions[slot] = static_cast<uint32_t>(bucket.size());
+        bucket.push_back(slot);
+    }
+
+    void removeFromCell(uint32_t slot) {
+        auto it = _grid.find(_cells[slot]);
+        std::vector<uint32_t>& bucket = it->second;
+        uint32_t position = _cellPositions[slot];
+        bucket[position] = bucket.back();
+        _cellPositions[bucket[position]] = position;
+        bucket.pop_back();
+        if (bucket.empty()) {
+            _grid.erase(it);
+        }
+    }
+
+    // Visit every slot in the grid cells overlapping the filter's box
+    template <typename Visitor>
+    void forEachInBox(const FleetFilter& filter, Visitor visit) const {
+        int32_t minRow = cellCoordinate(filter.minLat);
+        int32_t maxRow = cellCoordinate(filter.maxLat);
+        int32_t minColumn = cellCoordinate(filter.minLon);
+        int32_t maxColumn = cellCoordinate(filter.maxLon);
+        if (minRow > maxRow || minColumn > maxColumn) {
+            return;
+        }
+
+        // For boxes spanning more cells than are occupied, walk the occupied ones
+        double cellCount = (static_cast<double>(maxRow) - minRow + 1) * (static_cast<double>(maxColumn) - minColumn + 1);
+        if (cellCount > static_cast<double>(_grid.size())) {
+            for (const auto& cell : _grid) {
+                int32_t row = static_cast<int32_t>(cell.first >> 32);
+                int32_t column = static_cast<int32_t>(static_cast<uint32_t>(cell.first));
+                if (row >= minRow && row <= maxRow && column >= minColumn && column <= maxColumn) {
+                    for (uint32_t slot : cell.second) {
+                        visit(slot);
+                    }
+                }
+            }
+            return;
+        }
+
+        for (int32_t row = minRow; row <= maxRow; ++row) {
+            for (int32_t column = minColumn; column <= maxColumn; ++column) {
+                auto it = _grid.find(cellKey(row, column));
+                if (it == _grid.end()) {
+                    continue;
+                }
+                for (uint32_t slot : it->second) {
+                    visit(slot);
+                }
+            }
+        }
+    }
+
+    void appendFeature(std::string& out, size_t slot, TimestampCache& timeCache) const {
+        out += "{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":[";
+        Numbers::append(out, _lons[slot]);
+        out += ',';
+        Numbers::append(out, _lats[slot]);
+        out += "]},\"properties\":{\"id\":";
+        Numbers::append(out, _ids[slot]);
+        out += ",\"status\":\"";
+        out += statusToString(_status[slot]);
+        out += "\",\"timestamp\":\"";
+        out += timeCache.format(_timestamps[slot]);
+        out += "\",\"lastSeen\":";
+        Numbers::append(out, _lastSeen[slot]);
+        if (_velocityLats[slot] != 0 || _velocityLons[slot] != 0) {
+            out += ",\"velocity\":[";
+            Numbers::append(out, _velocityLons[slot]);
+            out += ',';
+            Numbers::append(out, _velocityLats[slot]);
+            out += ']';
+        }
+        out += "}}";
+    }
+};
+
+#endif // FLEETSHARD_H
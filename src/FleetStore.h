@@ -0,0 +1,381 @@
+#ifndef FLEETSTORE_H
+#define FLEETSTORE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include "FleetShard.h"
+
+// FleetListener: Told about every change to the fleet, in the order the
+// changes are applied to each shard. Calls are made with the shard's lock
+// held, so they must be quick.
+class FleetListener {
+public:
+    virtual ~FleetListener() = default;
+    virtual void positionsApplied(size_t /*shard*/, const PositionUpdate* /*updates*/, size_t /*count*/,
+                                  int64_t /*now*/) {}
+    virtual void statusChanged(size_t /*shard*/, int /*id*/, EBikeStatus /*status*/, int64_t /*now*/) {}
+    virtual void removed(size_t /*shard*/, int /*id*/) {}
+};
+
+// FleetStore: Latest known state of every eBike, indexed by bike ID.
+// Bikes are partitioned by ID into shards, each with its own lock, so
+// ingest workers that each own a shard never contend. GeoJSON is produced
+// on demand when the fleet is served, from a consistent view taken with
+// every shard locked.
+//
+// Every change stamps the record with the new fleet version, so clients
+// can ask for only the bikes changed (or removed) since a version they
+// already have.
+class FleetStore {
+public:
+    // Versions start from the creation time in microseconds so that a
+    // version handed out before a restart is never mistaken for a newer one
+    explicit FleetStore(size_t shardCount = 1)
+        : _version(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count())) {
+        if (shardCount == 0) {
+            shardCount = 1;
+        }
+        for (size_t i = 0; i < shardCount; ++i) {
+            _shards.emplace_back(new FleetShard(_version));
+        }
+    }
+
+    FleetStore(const FleetStore&) = delete;
+    FleetStore& operator=(const FleetStore&) = delete;
+
+    size_t shardCount() const {
+        return _shards.size();
+    }
+
+    // Shard owning an eBike ID
+    size_t shardOf(int id) const {
+        return static_cast<uint32_t>(id) % _shards.size();
+    }
+
+    // Register a listener for every later change
+    void addListener(FleetListener* listener) {
+        auto locks = lockAll();
+        _listeners.push_back(listener);
+    }
+
+    void removeListener(FleetListener* listener) {
+        auto locks = lockAll();
+        _listeners.erase(std::remove(_listeners.begin(), _listeners.end(), listener), _listeners.end());
+    }
+
+    // Insert or update the position and status of an eBike, optionally
+    // with when the fix was taken (milliseconds since the epoch). A fix
+    // older than the one already applied is ignored.
+    void updatePosition(int id, double lat, double lon, EBikeStatus status, int64_t sampleMs = 0) {
+        int64_t seenMs = currentTimeMs();
+        int64_t now = seenMs / 1000;
+        size_t shardIndex = shardOf(id);
+        FleetShard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.applyPosition(id, lat, lon, status, now, seenMs, sampleMs) && !_listeners.empty()) {
+            PositionUpdate update{id, lat, lon, status, sampleMs};
+            notifyPositions(shardIndex, &update, 1, now);
+        }
+    }
+
+    // Apply a batch of position reports, in order, taking each shard's lock once
+    void updatePositions(const PositionUpdate* updates, size_t count) {
+        if (_shards.size() == 1) {
+            updateShard(0, updates, count);
+            return;
+        }
+
+        // Partition the reports by shard in one pass, keeping each bike's in order
+        std::vector<size_t> offsets(_shards.size() + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            offsets[shardOf(updates[i].id) + 1]++;
+        }
+        for (size_t s = 1; s < offsets.size(); ++s) {
+            offsets[s] += offsets[s - 1];
+        }
+        std::vector<PositionUpdate> byShard(count);
+        std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < count; ++i) {
+            byShard[next[shardOf(updates[i].id)]++] = updates[i];
+        }
+
+        for (size_t s = 0; s < _shards.size(); ++s) {
+            if (offsets[s + 1] > offsets[s]) {
+                updateShard(s, byShard.data() + offsets[s], offsets[s + 1] - offsets[s]);
+            }
+        }
+    }
+
+    // Apply position reports that all belong to one shard under its lock,
+    // taking their versions in one block. Listeners are only told about
+    // the reports applied, not those of fixes older than the bike's.
+    void updateShard(size_t shardIndex, const PositionUpdate* updates, size_t count) {
+        int64_t seenMs = currentTimeMs();
+        int64_t now = seenMs / 1000;
+        FleetShard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        FleetShard::VersionBlock versions(shard, count);
+        std::vector<PositionUpdate> applied; // Only filled once a report is ignored
+        bool ignored = false;
+        for (size_t i = 0; i < count; ++i) {
+            if (!shard.applyPosition(updates[i].id, updates[i].lat, updates[i].lon, updates[i].status, now, seenMs,
+                    updates[i].sampleMs)) {
+                if (!ignored) {
+                    applied.assign(updates, updates + i);
+                    ignored = true;
+                }
+            } else if (ignored) {
+                applied.push_back(updates[i]);
+            }
+        }
+        if (ignored) {
+            notifyPositions(shardIndex, applied.data(), applied.size(), now);
+        } else {
+            notifyPositions(shardIndex, updates, count, now);
+        }
+    }
+
+    // Update the status of a known eBike; returns false if the ID is unknown
+    bool updateStatus(int id, EBikeStatus status) {
+        int64_t now = currentTime();
+        size_t shardIndex = shardOf(id);
+        FleetShard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.updateStatus(id, status, now)) {
+            return false;
+        }
+        for (FleetListener* listener : _listeners) {
+            listener->statusChanged(shardIndex, id, status, now);
+        }
+        return true;
+    }
+
+    // Remove an eBike from the fleet; returns false if the ID is unknown
+    bool remove(int id) {
+        size_t shardIndex = shardOf(id);
+        FleetShard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.remove(id)) {
+            return false;
+        }
+        for (FleetListener* listener : _listeners) {
+            listener->removed(shardIndex, id);
+        }
+        return true;
+    }
+
+    // Restore a record with its original timestamp, e.g. when recovering
+    // from a journal; listeners are not told
+    void restorePosition(int id, double lat, double lon, EBikeStatus status, int64_t timestamp) {
+        FleetShard& shard = *_shards[shardOf(id)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.applyPosition(id, lat, lon, status, timestamp, timestamp * 1000, 0);
+    }
+
+    void restoreStatus(int id, EBikeStatus status, int64_t timestamp) {
+        FleetShard& shard = *_shards[shardOf(id)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.updateStatus(id, status, timestamp);
+    }
+
+    void restoreRemoval(int id) {
+        FleetShard& shard = *_shards[shardOf(id)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.remove(id);
+    }
+
+    // Make room for a number of eBikes before restoring them
+    void reserve(size_t count) {
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->reserve(count / _shards.size() + 1);
+        }
+    }
+
+    // Call visit(id, lat, lon, status, timestamp) for every eBike of a
+    // shard, with only that shard locked
+    template <typename Visitor>
+    void forEachInShard(size_t shardIndex, Visitor visit) const {
+        const FleetShard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.forEach(visit);
+    }
+
+    // Version of the fleet state, incremented on every change
+    uint64_t version() const {
+        return _version.load(std::memory_order_acquire);
+    }
+
+    // Number of eBikes currently tracked
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total += shard->size();
+        }
+        return total;
+    }
+
+    // Serialize the whole fleet as a GeoJSON FeatureCollection
+    std::string toGeoJSON() const {
+        uint64_t ignored;
+        return toGeoJSON(ignored);
+    }
+
+    // Serialize the whole fleet, reporting the version the output reflects
+    std::string toGeoJSON(uint64_t& version) const {
+        return toGeoJSON(FleetFilter(), version);
+    }
+
+    // Serialize the eBikes matching a filter. Bounding-box queries visit
+    // only the grid cells overlapping the box, so their cost follows the
+    // number of bikes in the box rather than the fleet size.
+    std::string toGeoJSON(const FleetFilter& filter, uint64_t& version) const {
+        std::string out;
+        auto locks = lockAll();
+        version = _version.load(std::memory_order_acquire);
+        appendFleet(out, version, filter);
+        return out;
+    }
+
+    // Serialize only the eBikes changed or removed after the given version.
+    // If the changes since then are no longer all known, the whole fleet is
+    // returned with "full" set so the client replaces its state.
+    std::string toGeoJSONDelta(uint64_t since) const {
+        uint64_t ignored;
+        return toGeoJSONDelta(since, ignored);
+    }
+
+    // Serialize the changes after a version, reporting the version the output reflects
+    std::string toGeoJSONDelta(uint64_t since, uint64_t& version) const {
+        return toGeoJSONDelta(since, FleetFilter(), version);
+    }
+
+    // Serialize the changes after a version as seen through a filter: bikes
+    // that changed and no longer match (e.g. moved out of the box) are
+    // reported as removed if they matched before
+    std::string toGeoJSONDelta(uint64_t since, const FleetFilter& filter, uint64_t& version) const {
+        std::string out;
+        FleetDelta delta;
+        {
+            auto locks = lockAll();
+            if (!collectChanges(since, delta)) {
+                version = delta.version;
+                appendFleet(out, version, filter);
+                return out;
+            }
+        }
+        version = delta.version;
+        appendDelta(out, delta, filter);
+        return out;
+    }
+
+    // Collect the changes after a version, to render later without the
+    // shard locks; returns false if they are no longer all known
+    bool changesSince(uint64_t since, FleetDelta& delta) const {
+        auto locks = lockAll();
+        return collectChanges(since, delta);
+    }
+
+    // Serialize a delta as seen through a filter, for a viewer at the
+    // delta's earlier version or, if not exact, anywhere up to its later one
+    static void appendDelta(std::string& out, const FleetDelta& delta, const FleetFilter& filter, bool exact = true) {
+        appendHeader(out, delta.version, false);
+        bool first = true;
+        delta.appendFeatures(out, filter, first);
+        out += "],\"removed\":[";
+        first = true;
+        delta.appendRemoved(out, filter, exact, first);
+        out += "]}";
+    }
+
+private:
+    std::atomic<uint64_t> _version;
+    std::vector<std::unique_ptr<FleetShard>> _shards;
+    std::vector<FleetListener*> _listeners; // Changed only with every shard locked
+
+    // Called with the shard locked
+    void notifyPositions(size_t shardIndex, const PositionUpdate* updates, size_t count, int64_t now) {
+        for (FleetListener* listener : _listeners) {
+            listener->positionsApplied(shardIndex, updates, count, now);
+        }
+    }
+
+    // Called with every shard locked
+    bool collectChanges(uint64_t since, FleetDelta& delta) const {
+        delta.since = since;
+        delta.version = _version.load(std::memory_order_acquire);
+        if (since > delta.version) {
+            return false;
+        }
+        for (const auto& shard : _shards) {
+            if (since < shard->changeHorizon()) {
+                return false;
+            }
+        }
+
+        TimestampCache timeCache;
+        for (const auto& shard : _shards) {
+            shard->collectChanges(since, delta, timeCache);
+        }
+        return true;
+    }
+
+    // Lock every shard, always in the same order, for a consistent view.
+    // Every change numbered up to the version read afterwards is complete.
+    std::vector<std::unique_lock<std::mutex>> lockAll() const {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(_shards.size());
+        for (const auto& shard : _shards) {
+            locks.emplace_back(shard->mutex);
+        }
+        return locks;
+    }
+
+    static int64_t currentTime() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static int64_t currentTimeMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void appendHeader(std::string& out, uint64_t version, bool full) {
+        out += "{\"type\":\"FeatureCollection\",\"version\":";
+        Numbers::append(out, version);
+        out += full ? ",\"full\":true" : ",\"full\":false";
+        out += ",\"features\":[";
+    }
+
+    // Append every matching record as a full FeatureCollection; called with every shard locked
+    void appendFleet(std::string& out, uint64_t version, const FleetFilter& filter) const {
+        if (!filter.hasBox) {
+            // Roughly 170 bytes per feature
+            size_t total = 0;
+            for (const auto& shard : _shards) {
+                total += shard->size();
+            }
+            out.reserve(64 + total * 180);
+        }
+        appendHeader(out, version, true);
+
+        TimestampCache timeCache;
+        bool first = true;
+        for (const auto& shard : _shards) {
+            shard->appendFeatures(out, filter, first, timeCache);
+        }
+
+        out += "]}";
+    }
+};
+
+#endif // FLEETSTORE_H
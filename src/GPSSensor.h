@@ -8,6 +8,14 @@
 #include <vector>
 #include <cstdint>
 #include "hal/ISensor.h"
+#include "Numbers.h"
+
+// A GPS fix, laid out as the sensor's two columns so the HAL can read it
+// directly with readAs<GPSFix>()
+struct GPSFix {
+    double lat;
+    double lon;
+};
 
 class GPSSensor : public ISensor {
 private:
@@ -52,6 +60,29 @@ public:
         return getCurrentTimestamp() + " GPS: " + readingStr;
     }
 
+    // Format a typed fix the same way, without a byte vector
+    std::string format(const GPSFix& fix) {
+        char buffer[2 * Numbers::MaxLength + 2];
+        char* out = Numbers::format(buffer, fix.lat);
+        *out++ = ';';
+        *out++ = ' ';
+        out = Numbers::format(out, fix.lon);
+        return getCurrentTimestamp() + " GPS: " + std::string(buffer, out);
+    }
+
+    using ISensor::decode;
+
+    // Decode a byte reading into a fix; returns false if it is malformed
+    bool decode(const std::vector<uint8_t>& reading, GPSFix& fix) const {
+        double values[2];
+        if (!ISensor::decode(reading.data(), reading.size(), values)) {
+            return false;
+        }
+        fix.lat = values[0];
+        fix.lon = values[1];
+        return true;
+    }
+
     bool connect(const std::string& reading) {
         // Find the comma separator
         size_t commaPos = reading.find(',');
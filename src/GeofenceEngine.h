@@ -0,0 +1,279 @@
+#ifndef GEOFENCEENGINE_H
+#define GEOFENCEENGINE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include "FleetStore.h"
+#include "Numbers.h"
+#include "GeofenceIndex.h"
+#include "Metrics.h"
+
+// A bike entering or leaving a fence
+struct GeofenceEvent {
+    uint64_t sequence;
+    int64_t time; // Seconds since the epoch
+    int bikeId;
+    uint32_t fence; // Index in the GeofenceIndex
+    bool entered;
+    double lat;
+    double lon;
+};
+
+// GeofenceEngine: Checks every position update against the geofences and
+// records an event whenever a bike enters or leaves one.
+//
+// It listens to the fleet's change feed, so each update is checked in the
+// ingest worker that applies it, under that shard's lock. Each bike's
+// current fences are kept per shard; the recent events are kept in one
+// bounded log with increasing sequence numbers for clients to page through.
+// A bike removed from the fleet leaves every fence it was in.
+class GeofenceEngine : public FleetListener {
+public:
+    // Events kept for queries; older ones are forgotten
+    static const size_t MaxEvents = 65536;
+
+    GeofenceEngine(FleetStore& fleet, GeofenceIndex index)
+        : _fleet(fleet), _index(std::move(index)), _shards(fleet.shardCount()),
+          _checks(Metrics::instance().counter("gateway_geofence_checks_total",
+              "Position updates checked against the geofences")),
+          _entered(Metrics::instance().counter("gateway_geofence_events_total",
+              "Geofence events, by type", "type=\"enter\"")),
+          _exited(Metrics::instance().counter("gateway_geofence_events_total",
+              "Geofence events, by type", "type=\"exit\"")) {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _shards[i].reset(new Shard);
+        }
+        Metrics::instance().gauge("gateway_geofences", "Geofences loaded").set(static_cast<int64_t>(_index.size()));
+        _fleet.addListener(this);
+    }
+
+    ~GeofenceEngine() {
+        _fleet.removeListener(this);
+    }
+
+    GeofenceEngine(const GeofenceEngine&) = delete;
+    GeofenceEngine& operator=(const GeofenceEngine&) = delete;
+
+    const GeofenceIndex& index() const {
+        return _index;
+    }
+
+    // Take every bike's current fences from the fleet without recording
+    // any events. Call once the fleet is restored from disk, so bikes that
+    // were already inside a fence do not enter it again on their next report.
+    void seed() {
+        if (_index.size() == 0) {
+            return;
+        }
+        for (size_t shardIndex = 0; shardIndex < _shards.size(); ++shardIndex) {
+            Shard& shard = *_shards[shardIndex];
+            // Fleet shard lock first, as on the change feed
+            _fleet.forEachInShard(shardIndex, [&](int id, double lat, double lon, EBikeStatus, int64_t) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.inside.clear();
+                _index.containing(lat, lon, [&](uint32_t fence) { shard.inside.push_back(fence); });
+                if (shard.inside.empty()) {
+                    shard.bikes.erase(id);
+                    return;
+                }
+                std::sort(shard.inside.begin(), shard.inside.end());
+                shard.bikes[id] = Membership{shard.inside, lat, lon};
+            });
+        }
+    }
+
+    // Serialize the events after a sequence number, optionally only those
+    // of one bike (bikeId >= 0) or one fence (by its ID), oldest first:
+    //
+    //   {"events":[{"sequence":..,"time":..,"bike":..,"fence":..,"name":..,
+    //     "kind":..,"type":"enter","lat":..,"lon":..}],"next":..,"missed":false}
+    //
+    // "next" is the sequence to ask for events after; "missed" is true if
+    // events after since were already forgotten.
+    std::string toJSON(uint64_t since, int bikeId, int fenceId, bool hasFence, size_t limit) const {
+        std::string out = "{\"events\":[";
+        uint64_t next = since;
+        bool missed = false;
+        {
+            std::lock_guard<std::mutex> lock(_eventsMutex);
+            missed = !_events.empty() && _events.front().sequence > since + 1;
+            next = std::max(since, _nextSequence - 1);
+
+            // Sequences are consecutive, so the first event wanted can be found directly
+            size_t start = 0;
+            if (!_events.empty() && since >= _events.front().sequence) {
+                start = static_cast<size_t>(since - _events.front().sequence + 1);
+            }
+
+            size_t count = 0;
+            for (size_t i = start; i < _events.size(); ++i) {
+                const GeofenceEvent& event = _events[i];
+                const Geofence& fence = _index.fence(event.fence);
+                if ((bikeId >= 0 && event.bikeId != bikeId) || (hasFence && fence.id != fenceId)) {
+                    continue;
+                }
+                if (count == limit) {
+                    next = event.sequence - 1;
+                    break;
+                }
+                if (count++) {
+                    out += ',';
+                }
+                appendEvent(out, event, fence);
+            }
+        }
+        out += "],\"next\":";
+        Numbers::append(out, next);
+        out += ",\"missed\":";
+        out += missed ? "true" : "false";
+        out += '}';
+        return out;
+    }
+
+    // FleetListener, called with the fleet shard locked
+    void positionsApplied(size_t shardIndex, const PositionUpdate* updates, size_t count, int64_t now) override {
+        if (_index.size() == 0) {
+            return;
+        }
+        Shard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        _checks.increment(count);
+
+        for (size_t i = 0; i < count; ++i) {
+            const PositionUpdate& update = updates[i];
+            shard.inside.clear();
+            _index.containing(update.lat, update.lon, [&](uint32_t fence) { shard.inside.push_back(fence); });
+            std::sort(shard.inside.begin(), shard.inside.end());
+
+            auto found = shard.bikes.find(update.id);
+            if (found == shard.bikes.end()) {
+                if (shard.inside.empty()) {
+                    continue;
+                }
+                found = shard.bikes.emplace(update.id, Membership()).first;
+            }
+            found->second.lat = update.lat;
+            found->second.lon = update.lon;
+            std::vector<uint32_t>& previous = found->second.fences;
+            if (previous == shard.inside) {
+                continue;
+            }
+
+            // Fences left, then fences entered
+            for (uint32_t fence : previous) {
+                if (!std::binary_search(shard.inside.begin(), shard.inside.end(), fence)) {
+                    record(update, fence, false, now);
+                }
+            }
+            for (uint32_t fence : shard.inside) {
+                if (!std::binary_search(previous.begin(), previous.end(), fence)) {
+                    record(update, fence, true, now);
+                }
+            }
+
+            if (shard.inside.empty()) {
+                shard.bikes.erase(found);
+            } else {
+                previous = shard.inside;
+            }
+        }
+    }
+
+    void removed(size_t shardIndex, int id) override {
+        Shard& shard = *_shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.bikes.find(id);
+        if (found == shard.bikes.end()) {
+            return;
+        }
+
+        // Exits at the bike's last position
+        int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        PositionUpdate last{id, found->second.lat, found->second.lon, EBikeStatus::Unlocked};
+        for (uint32_t fence : found->second.fences) {
+            record(last, fence, false, now);
+        }
+        shard.bikes.erase(found);
+    }
+
+private:
+    // The fences a bike is in, and where it was last reported
+    struct Membership {
+        std::vector<uint32_t> fences; // Sorted
+        double lat;
+        double lon;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int, Membership> bikes; // Only bikes inside at least one fence
+        std::vector<uint32_t> inside; // Scratch for the fences containing one update
+    };
+
+    FleetStore& _fleet;
+    GeofenceIndex _index;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    mutable std::mutex _eventsMutex;
+    std::deque<GeofenceEvent> _events; // Oldest first, consecutive sequences
+    uint64_t _nextSequence = 1;
+    Counter& _checks;
+    Counter& _entered;
+    Counter& _exited;
+
+    void record(const PositionUpdate& update, uint32_t fence, bool entered, int64_t now) {
+        (entered ? _entered : _exited).increment();
+        std::lock_guard<std::mutex> lock(_eventsMutex);
+        _events.push_back(GeofenceEvent{_nextSequence++, now, update.id, fence, entered, update.lat, update.lon});
+        if (_events.size() > MaxEvents) {
+            _events.pop_front();
+        }
+    }
+
+    static void appendString(std::string& out, const std::string& text) {
+        out += '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    static void appendEvent(std::string& out, const GeofenceEvent& event, const Geofence& fence) {
+        out += "{\"sequence\":";
+        Numbers::append(out, event.sequence);
+        out += ",\"time\":";
+        Numbers::append(out, event.time);
+        out += ",\"bike\":";
+        Numbers::append(out, event.bikeId);
+        out += ",\"fence\":";
+        Numbers::append(out, fence.id);
+        out += ",\"name\":";
+        appendString(out, fence.name);
+        out += ",\"kind\":";
+        appendString(out, fence.kind);
+        out += event.entered ? ",\"type\":\"enter\",\"lat\":" : ",\"type\":\"exit\",\"lat\":";
+        Numbers::append(out, event.lat);
+        out += ",\"lon\":";
+        Numbers::append(out, event.lon);
+        out += '}';
+    }
+};
+
+#endif // GEOFENCEENGINE_H
@@ -0,0 +1,338 @@
+#ifndef GEOFENCEINDEX_H
+#define GEOFENCEINDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <Poco/JSON/Parser.h>
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Array.h>
+#include <Poco/Dynamic/Var.h>
+
+struct GeoPoint {
+    double lon;
+    double lat;
+};
+
+// A named polygon, e.g. a service area or a no-parking zone. The first
+// ring is the outline and any further rings are holes (even-odd rule).
+struct Geofence {
+    int id = 0;
+    std::string name;
+    std::string kind; // e.g. "service-area", "no-parking"
+    std::vector<std::vector<GeoPoint>> rings;
+};
+
+// GeofenceIndex: Finds the fences containing a point in time independent
+// of the number of fences.
+//
+// Fences are indexed in a uniform lat/lon grid. For each cell a fence
+// overlaps, the index stores whether the cell's centre is inside the fence
+// and the fence edges that cross the cell. A point is then inside the fence
+// if the centre is and the segment from the point to the centre crosses
+// those edges an even number of times, or if the centre is not and it
+// crosses them an odd number of times. Cells entirely inside a fence have
+// no edges and need no test at all. A lookup therefore only touches the
+// fences and edges of one cell, however many fences are loaded and however
+// detailed they are.
+//
+// Build the index before sharing it; lookups are read-only.
+class GeofenceIndex {
+public:
+    // Grid cell size in degrees (about 1 km of latitude)
+    static constexpr double CellSize = 0.01;
+
+    // Add a fence; returns its index
+    size_t add(const Geofence& fence) {
+        uint32_t fenceIndex = static_cast<uint32_t>(_fences.size());
+        _fences.push_back(fence);
+
+        double minLon = INFINITY, minLat = INFINITY, maxLon = -INFINITY, maxLat = -INFINITY;
+        for (const auto& ring : fence.rings) {
+            for (const GeoPoint& point : ring) {
+                minLon = std::min(minLon, point.lon);
+                maxLon = std::max(maxLon, point.lon);
+                minLat = std::min(minLat, point.lat);
+                maxLat = std::max(maxLat, point.lat);
+            }
+        }
+        _bounds.push_back(Bounds{minLon, minLat, maxLon, maxLat});
+        if (minLon > maxLon) {
+            return fenceIndex; // No points
+        }
+
+        // Edges crossing each cell of the fence's bounding box
+        std::unordered_map<int64_t, std::vector<Edge>> cellEdges;
+        for (const auto& ring : fence.rings) {
+            for (size_t i = 0; i < ring.size(); ++i) {
+                Edge edge{ring[i], ring[(i + 1) % ring.size()]};
+                forEachCellCrossed(edge, [&](int64_t key) { cellEdges[key].push_back(edge); });
+            }
+        }
+
+        for (int32_t row = cellCoordinate(minLat); row <= cellCoordinate(maxLat); ++row) {
+            for (int32_t column = cellCoordinate(minLon); column <= cellCoordinate(maxLon); ++column) {
+                int64_t key = cellKey(row, column);
+                GeoPoint centre = cellCentre(row, column);
+                bool centreInside = contains(fence, centre);
+                auto edges = cellEdges.find(key);
+
+                CellEntry entry{fenceIndex, centreInside, static_cast<uint32_t>(_edges.size()), 0};
+                if (edges != cellEdges.end()) {
+                    _edges.insert(_edges.end(), edges->second.begin(), edges->second.end());
+                    entry.edgeCount = static_cast<uint32_t>(edges->second.size());
+                } else if (!centreInside) {
+                    continue; // The cell is entirely outside the fence
+                }
+                _cells[key].push_back(entry);
+            }
+        }
+        return fenceIndex;
+    }
+
+    // Load fences from a GeoJSON FeatureCollection of Polygon and
+    // MultiPolygon features, with optional id, name and kind properties;
+    // returns the number of fences loaded
+    size_t loadGeoJSON(const std::string& filePath) {
+        std::ifstream file(filePath);
+        if (!file) {
+            throw std::runtime_error("Failed to open geofence file: " + filePath);
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+
+        Poco::JSON::Parser parser;
+        Poco::JSON::Object::Ptr root = parser.parse(contents.str()).extract<Poco::JSON::Object::Ptr>();
+        Poco::JSON::Array::Ptr features = root->getArray("features");
+        if (!features) {
+            throw std::runtime_error("Geofence file has no features: " + filePath);
+        }
+
+        size_t loaded = 0;
+        for (unsigned i = 0; i < features->size(); ++i) {
+            Poco::JSON::Object::Ptr feature = features->getObject(i);
+            Poco::JSON::Object::Ptr geometry = feature->getObject("geometry");
+            if (!geometry) {
+                continue;
+            }
+
+            Geofence fence;
+            fence.id = static_cast<int>(_fences.size());
+            Poco::JSON::Object::Ptr properties = feature->getObject("properties");
+            if (properties) {
+                if (properties->has("id")) {
+                    fence.id = properties->getValue<int>("id");
+                }
+                if (properties->has("name")) {
+                    fence.name = properties->getValue<std::string>("name");
+                }
+                if (properties->has("kind")) {
+                    fence.kind = properties->getValue<std::string>("kind");
+                }
+            }
+
+            std::string type = geometry->getValue<std::string>("type");
+            Poco::JSON::Array::Ptr coordinates = geometry->getArray("coordinates");
+            if (type == "Polygon") {
+                readRings(coordinates, fence);
+            } else if (type == "MultiPolygon") {
+                // Disjoint parts of one fence; even-odd over all rings still holds
+                for (unsigned p = 0; p < coordinates->size(); ++p) {
+                    readRings(coordinates->getArray(p), fence);
+                }
+            } else {
+                continue;
+            }
+            add(fence);
+            loaded++;
+        }
+        return loaded;
+    }
+
+    size_t size() const {
+        return _fences.size();
+    }
+
+    const Geofence& fence(size_t index) const {
+        return _fences[index];
+    }
+
+    // Call visit(fenceIndex) for every fence containing a point
+    template <typename Visitor>
+    void containing(double lat, double lon, Visitor visit) const {
+        int32_t row = cellCoordinate(lat);
+        int32_t column = cellCoordinate(lon);
+        auto cell = _cells.find(cellKey(row, column));
+        if (cell == _cells.end()) {
+            return;
+        }
+
+        GeoPoint point{lon, lat};
+        GeoPoint centre = cellCentre(row, column);
+        for (const CellEntry& entry : cell->second) {
+            const Bounds& bounds = _bounds[entry.fence];
+            if (lon < bounds.minLon || lon > bounds.maxLon || lat < bounds.minLat || lat > bounds.maxLat) {
+                continue;
+            }
+            bool inside = entry.centreInside;
+            for (uint32_t e = entry.firstEdge; e < entry.firstEdge + entry.edgeCount; ++e) {
+                if (crosses(point, centre, _edges[e])) {
+                    inside = !inside;
+                }
+            }
+            if (inside) {
+                visit(entry.fence);
+            }
+        }
+    }
+
+    // Full point-in-polygon test by ray casting over every edge
+    static bool contains(const Geofence& fence, GeoPoint point) {
+        bool inside = false;
+        for (const auto& ring : fence.rings) {
+            for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+                const GeoPoint& a = ring[i];
+                const GeoPoint& b = ring[j];
+                if ((a.lat > point.lat) != (b.lat > point.lat) &&
+                    point.lon < (b.lon - a.lon) * (point.lat - a.lat) / (b.lat - a.lat) + a.lon) {
+                    inside = !inside;
+                }
+            }
+        }
+        return inside;
+    }
+
+private:
+    struct Edge {
+        GeoPoint a;
+        GeoPoint b;
+    };
+
+    struct Bounds {
+        double minLon;
+        double minLat;
+        double maxLon;
+        double maxLat;
+    };
+
+    // A fence overlapping a cell
+    struct CellEntry {
+        uint32_t fence;
+        bool centreInside;
+        uint32_t firstEdge; // Edges crossing the cell, in _edges
+        uint32_t edgeCount;
+    };
+
+    std::vector<Geofence> _fences;
+    std::vector<Bounds> _bounds; // Bounding box of each fence, checked before its edges
+    std::unordered_map<int64_t, std::vector<CellEntry>> _cells;
+    std::vector<Edge> _edges;
+
+    // Fence and bike positions are validated on the way in, but the cast
+    // is kept defined for any value: NaN lands in cell 0 and anything
+    // beyond the globe in the cells at its edge
+    static int32_t cellCoordinate(double degrees) {
+        const double maxCell = 180 / CellSize + 1;
+        double cell = std::floor(degrees / CellSize);
+        if (std::isnan(cell)) {
+            return 0;
+        }
+        return static_cast<int32_t>(std::max(-maxCell, std::min(maxCell, cell)));
+    }
+
+    static int64_t cellKey(int32_t row, int32_t column) {
+        return static_cast<int64_t>((static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) |
+            static_cast<uint32_t>(column));
+    }
+
+    static GeoPoint cellCentre(int32_t row, int32_t column) {
+        return GeoPoint{(column + 0.5) * CellSize, (row + 0.5) * CellSize};
+    }
+
+    static double orientation(GeoPoint a, GeoPoint b, GeoPoint c) {
+        return (b.lon - a.lon) * (c.lat - a.lat) - (b.lat - a.lat) * (c.lon - a.lon);
+    }
+
+    // Whether segment pq crosses an edge. Edge endpoints lying exactly on
+    // the line through pq count as being on its positive side, the same
+    // half-open rule ray casting uses, so a vertex is never counted twice.
+    static bool crosses(GeoPoint p, GeoPoint q, const Edge& edge) {
+        if ((orientation(p, q, edge.a) > 0) == (orientation(p, q, edge.b) > 0)) {
+            return false;
+        }
+        double side = orientation(edge.a, edge.b, p) * orientation(edge.a, edge.b, q);
+        return side < 0;
+    }
+
+    // Call visit(cellKey) for every cell a segment passes through
+    template <typename Visitor>
+    static void forEachCellCrossed(const Edge& edge, Visitor visit) {
+        int32_t minRow = cellCoordinate(std::min(edge.a.lat, edge.b.lat));
+        int32_t maxRow = cellCoordinate(std::max(edge.a.lat, edge.b.lat));
+        int32_t minColumn = cellCoordinate(std::min(edge.a.lon, edge.b.lon));
+        int32_t maxColumn = cellCoordinate(std::max(edge.a.lon, edge.b.lon));
+
+        for (int32_t row = minRow; row <= maxRow; ++row) {
+            for (int32_t column = minColumn; column <= maxColumn; ++column) {
+                if (minRow == maxRow || minColumn == maxColumn || segmentTouchesCell(edge, row, column)) {
+                    visit(cellKey(row, column));
+                }
+            }
+        }
+    }
+
+    // Whether a segment passes through a cell (Liang-Barsky clipping)
+    static bool segmentTouchesCell(const Edge& edge, int32_t row, int32_t column) {
+        double x0 = column * CellSize, x1 = (column + 1) * CellSize;
+        double y0 = row * CellSize, y1 = (row + 1) * CellSize;
+        double dx = edge.b.lon - edge.a.lon, dy = edge.b.lat - edge.a.lat;
+        double p[4] = {-dx, dx, -dy, dy};
+        double q[4] = {edge.a.lon - x0, x1 - edge.a.lon, edge.a.lat - y0, y1 - edge.a.lat};
+        double t0 = 0, t1 = 1;
+        for (int i = 0; i < 4; ++i) {
+            if (p[i] == 0) {
+                if (q[i] < 0) {
+                    return false;
+                }
+            } else {
+                double t = q[i] / p[i];
+                if (p[i] < 0) {
+                    t0 = std::max(t0, t);
+                } else {
+                    t1 = std::min(t1, t);
+                }
+            }
+        }
+        return t0 <= t1;
+    }
+
+    static void readRings(const Poco::JSON::Array::Ptr& rings, Geofence& fence) {
+        for (unsigned r = 0; rings && r < rings->size(); ++r) {
+            Poco::JSON::Array::Ptr positions = rings->getArray(r);
+            std::vector<GeoPoint> ring;
+            for (unsigned i = 0; positions && i < positions->size(); ++i) {
+                Poco::JSON::Array::Ptr position = positions->getArray(i);
+                GeoPoint point{position->getElement<double>(0), position->getElement<double>(1)};
+                if (!(point.lat >= -90 && point.lat <= 90 && point.lon >= -180 && point.lon <= 180)) {
+                    throw std::runtime_error("Geofence position out of range");
+                }
+                ring.push_back(point);
+            }
+            // GeoJSON repeats the first position at the end
+            if (ring.size() > 1 && ring.front().lon == ring.back().lon && ring.front().lat == ring.back().lat) {
+                ring.pop_back();
+            }
+            if (ring.size() >= 3) {
+                fence.rings.push_back(ring);
+            }
+        }
+    }
+};
+
+#endif // GEOFENCEINDEX_H
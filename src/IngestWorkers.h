@@ -0,0 +1,253 @@
+#ifndef INGESTWORKERS_H
+#define INGESTWORKERS_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include "FleetStore.h"
+#include "BoundedQueue.h"
+#include "Pipeline.h"
+#include "PositionCoalescer.h"
+
+// IngestWorkers: The apply stage of the ingest pipeline. Applies position
+// reports to the fleet on several cores. There is one worker per fleet
+// shard, and reports are partitioned by bike ID, so each worker is the
+// only writer of its shard and updates for one bike are applied in the
+// order they were received.
+//
+// Each worker is fed through a bounded lock-free queue. When a queue is
+// more than half full, CoalescePositions first keeps only the latest
+// report per bike of each submitted batch; a queue that is still full
+// drops its oldest report (or the new one, with DropNewest). Only reports
+// that leave their bike's status as the one before it are dropped: when
+// the oldest report changes a status the new one is refused instead, and
+// a new report that changes a status waits for the worker to make room.
+//
+// A worker applies only the newest of the reports it takes off its queue
+// together for each bike. With a coalescing tick it also holds them for
+// up to one tick, so a bike flushing buffered positions costs one fleet
+// update per tick. Status changes are never coalesced away, and a pending
+// waitForShard() ends the tick early.
+class IngestWorkers {
+public:
+    // Most reports applied under one shard lock
+    static const size_t MaxBatch = 4096;
+
+    explicit IngestWorkers(FleetStore& fleet, const PipelineOptions& options = PipelineOptions())
+        : _fleet(fleet), _policy(options.applyPolicy), _tick(options.coalesceTick), _running(true),
+          _metrics("apply"),
+          _coalesced(Metrics::instance().counter("gateway_positions_coalesced_total",
+              "Position reports superseded by a newer report for the same bike before being applied")) {
+        for (size_t i = 0; i < fleet.shardCount(); ++i) {
+            _workers.emplace_back(new Worker(options.applyCapacity));
+        }
+        for (size_t i = 0; i < _workers.size(); ++i) {
+            _workers[i]->thread = std::thread(&IngestWorkers::workerLoop, this, i);
+        }
+    }
+
+    ~IngestWorkers() {
+        stop();
+    }
+
+    IngestWorkers(const IngestWorkers&) = delete;
+    IngestWorkers& operator=(const IngestWorkers&) = delete;
+
+    size_t workerCount() const {
+        return _workers.size();
+    }
+
+    // Queue position reports for the workers owning their bikes. Called
+    // by a single producer (the decode stage).
+    void submit(const PositionUpdate* updates, size_t count) {
+        if (_policy == OverloadPolicy::CoalescePositions && isBackedUp()) {
+            _overloadCoalescer.clear();
+            for (size_t i = 0; i < count; ++i) {
+                if (_overloadCoalescer.add(updates[i])) {
+                    _coalesced.increment();
+                }
+            }
+            updates = _overloadCoalescer.data();
+            count = _overloadCoalescer.size();
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            Worker& worker = *_workers[_fleet.shardOf(updates[i].id)];
+            auto last = _queuedStatus.emplace(updates[i].id, updates[i].status);
+            bool changesStatus = last.second || last.first->second != updates[i].status;
+            last.first->second = updates[i].status;
+            if (push(worker, QueuedReport{updates[i], changesStatus})) {
+                // Counted before the doorbell rings so waitForShard() sees it
+                worker.submitted.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        for (auto& worker : _workers) {
+            worker->doorbell.ring();
+        }
+    }
+
+    // Wait until every report queued for an eBike's shard has been applied
+    void waitForShard(int id) {
+        Worker& worker = *_workers[_fleet.shardOf(id)];
+        uint64_t target = worker.submitted.load(std::memory_order_acquire);
+        worker.waiters.fetch_add(1, std::memory_order_seq_cst);
+        worker.doorbell.ring(); // End the worker's coalescing tick now
+        {
+            std::unique_lock<std::mutex> lock(worker.idleMutex);
+            worker.idle.wait(lock, [&] {
+                return worker.retired.load(std::memory_order_seq_cst) >= target || !_running;
+            });
+        }
+        worker.waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Apply what is queued, then stop the workers
+    void stop() {
+        if (!_running.exchange(false)) {
+            return;
+        }
+        for (auto& worker : _workers) {
+            worker->doorbell.ring();
+            std::lock_guard<std::mutex> lock(worker->idleMutex);
+            worker->idle.notify_all();
+        }
+        for (auto& worker : _workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+    }
+
+private:
+    // A report with whether its status differs from the bike's report
+    // before it (or it is the first seen for the bike)
+    struct QueuedReport {
+        PositionUpdate update;
+        bool changesStatus;
+    };
+
+    struct Worker {
+        explicit Worker(size_t capacity) : queue(capacity) {}
+
+        BoundedQueue<QueuedReport> queue;
+        Doorbell doorbell;
+        std::atomic<uint64_t> submitted{0}; // Reports queued, whether applied or dropped later
+        std::atomic<uint64_t> retired{0}; // Reports applied or dropped
+        std::atomic<int> waiters{0}; // Threads in waitForShard()
+        std::mutex idleMutex;
+        std::condition_variable idle;
+        std::thread thread;
+    };
+
+    FleetStore& _fleet;
+    OverloadPolicy _policy;
+    std::chrono::milliseconds _tick;
+    std::atomic<bool> _running;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    StageMetrics _metrics;
+    Counter& _coalesced;
+    PositionCoalescer _overloadCoalescer; // Producer only
+    std::unordered_map<int, EBikeStatus> _queuedStatus; // Status of each bike's last queued report; producer only
+
+    // Queue one report, applying the overload policy if the queue is full;
+    // returns false if the report was dropped. Reports that change a
+    // bike's status are never dropped.
+    bool push(Worker& worker, const QueuedReport& report) {
+        _metrics.depth.add(1);
+        while (!worker.queue.tryPush(report)) {
+            // Make room by discarding the report that has waited longest,
+            // unless it changes a status
+            QueuedReport oldest;
+            if (_policy != OverloadPolicy::DropNewest &&
+                worker.queue.tryPopUnless([](const QueuedReport& queued) { return queued.changesStatus; }, oldest)) {
+                _metrics.dropped.increment();
+                _metrics.depth.add(-1);
+                retire(worker, 1);
+                continue;
+            }
+            if (!report.changesStatus) {
+                _metrics.dropped.increment();
+                _metrics.depth.add(-1);
+                return false;
+            }
+            // Neither can go: wait for the worker to take reports off the queue
+            worker.doorbell.ring();
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    bool isBackedUp() const {
+        for (const auto& worker : _workers) {
+            if (worker->queue.size() * 2 > worker->queue.capacity()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void retire(Worker& worker, size_t count) {
+        worker.retired.fetch_add(count, std::memory_order_seq_cst);
+        if (worker.waiters.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(worker.idleMutex);
+            worker.idle.notify_all();
+        }
+    }
+
+    void workerLoop(size_t shardIndex) {
+        Worker& worker = *_workers[shardIndex];
+        PositionCoalescer pending;
+        size_t taken = 0; // Reports taken off the queue since the last apply
+        std::chrono::steady_clock::time_point deadline;
+
+        while (true) {
+            QueuedReport report;
+            while (pending.size() < MaxBatch && worker.queue.tryPop(report)) {
+                if (taken++ == 0) {
+                    deadline = std::chrono::steady_clock::now() + _tick;
+                }
+                if (pending.add(report.update)) {
+                    _coalesced.increment();
+                }
+            }
+
+            if (pending.empty()) {
+                if (!_running) {
+                    return;
+                }
+                worker.doorbell.wait([&] { return !worker.queue.empty() || !_running; },
+                    std::chrono::milliseconds(100));
+                continue;
+            }
+
+            // Hold the reports until the tick ends, unless someone is waiting for them
+            bool due = _tick.count() == 0 || pending.size() >= MaxBatch || !_running ||
+                worker.waiters.load(std::memory_order_seq_cst) > 0 || std::chrono::steady_clock::now() >= deadline;
+            if (!due) {
+                // A waitForShard() that starts after due was computed rings
+                // before this thread may be asleep, so its count is checked too
+                worker.doorbell.wait([&] {
+                    return !worker.queue.empty() || !_running || worker.waiters.load(std::memory_order_seq_cst) > 0;
+                },
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()) + std::chrono::milliseconds(1));
+                continue;
+            }
+
+            // Everything pending goes in under one shard lock
+            _fleet.updateShard(shardIndex, pending.data(), pending.size());
+            _metrics.processed.increment(taken);
+            _metrics.depth.add(-static_cast<int64_t>(taken));
+            retire(worker, taken);
+            pending.clear();
+            taken = 0;
+        }
+    }
+};
+
+#endif // INGESTWORKERS_H
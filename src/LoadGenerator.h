@@ -0,0 +1,364 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <glob.h>
+#include "hal/CSVHALManager.h"
+#include "GPSSensor.h"
+#include "ReportPolicy.h"
+#include "BinaryProtocol.h"
+#include "Numbers.h"
+#include "sim/socket.h"
+
+// Smallest buffer encodePositionJSON() writes into
+const size_t PositionJSONBufferSize = 128 + 4 * Numbers::MaxLength;
+
+// Write a JSON position report whose coordinates read back exactly, with
+// the time the fix was taken (milliseconds since the epoch) if known;
+// returns its length, or 0 if the buffer is smaller than PositionJSONBufferSize
+inline size_t encodePositionJSON(char* buffer, size_t size, int id, double lat, double lon,
+                                 int64_t sampleMs = 0) {
+    if (size < PositionJSONBufferSize) {
+        return 0;
+    }
+    auto put = [](char* out, const char* text) {
+        size_t length = std::strlen(text);
+        std::memcpy(out, text, length);
+        return out + length;
+    };
+    char* out = put(buffer, "{\"type\":\"position\",\"id\":");
+    out = Numbers::format(out, id);
+    out = put(out, ",\"lat\":");
+    out = Numbers::format(out, lat);
+    out = put(out, ",\"lon\":");
+    out = Numbers::format(out, lon);
+    if (sampleMs > 0) {
+        out = put(out, ",\"sampleTime\":");
+        out = Numbers::format(out, sampleMs);
+    }
+    out = put(out, ",\"status\":\"unlocked\"}");
+    return static_cast<size_t>(out - buffer);
+}
+
+// Settings for a load generator run
+struct LoadOptions {
+    std::string tracks = "data/sim-eBike-*.csv"; // Glob of CSV tracks to replay
+    int bikes = 100; // Virtual bikes
+    int idOffset = 1000; // ID of the first virtual bike
+    double rate = 1000; // Aggregate GPS samples per second, each sent unless adaptive holds it back
+    double duration = 10; // Seconds of sending
+    double jitter = 0.0001; // Largest random offset added to each coordinate, in degrees
+    bool binary = false; // Send the binary protocol instead of JSON
+    double parked = 0; // Fraction of bikes standing still at their starting point
+    bool adaptive = false; // Send only the samples the report policy asks for
+    ReportPolicyOptions policy;
+    double drainTimeout = 1; // Seconds to wait for late responses after sending
+};
+
+// LoadGenerator: Replays the recorded tracks as many virtual eBikes, sending
+// position reports to the gateway at a fixed aggregate rate, and measures
+// throughput, response latency and loss.
+//
+// Bikes are spread over the tracks, each starting at a different point,
+// and every report gets a random jitter so the bikes do not overlap. In
+// adaptive mode each bike runs a ReportPolicy and sends only the samples
+// it asks for; the jitter is then fixed per bike, so the policy sees the
+// track rather than noise.
+// Sends and receives run on one thread: the gateway answers a client's
+// datagrams in the order it received them, so each response is matched to
+// the oldest unanswered report. A lost datagram would shift that matching
+// for every later response, so reports are sent from a fresh socket every
+// window and a window's latencies only count once every report sent from
+// it has been answered; a window still waiting after drainTimeout had a
+// loss, and its latencies are left out.
+class LoadGenerator {
+public:
+    // Time each socket is sent from
+    static constexpr std::chrono::milliseconds Window{100};
+
+    LoadGenerator(const LoadOptions& options, const struct sockaddr_in& gateway)
+        : _options(options), _gateway(gateway), _random(std::random_device{}()) {
+        loadTracks();
+    }
+
+    // Run the load and print a report; returns false if no response was received
+    bool run() {
+        std::vector<Bike> bikes(static_cast<size_t>(_options.bikes));
+        for (size_t i = 0; i < bikes.size(); ++i) {
+            bikes[i].id = _options.idOffset + static_cast<int>(i);
+            bikes[i].track = &_tracks[i % _tracks.size()];
+            // Bikes sharing a track start at different points along it
+            bikes[i].position = (i / _tracks.size()) * 7 % bikes[i].track->size();
+            bikes[i].parked = i < static_cast<size_t>(_options.parked * bikes.size() + 0.5);
+            bikes[i].policy = ReportPolicy(_options.policy);
+        }
+
+        std::uniform_real_distribution<double> jitter(-_options.jitter, _options.jitter);
+        if (_options.adaptive) {
+            for (Bike& bike : bikes) {
+                bike.offset = GPSFix{jitter(_random), jitter(_random)};
+            }
+        }
+        const Clock::duration interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / _options.rate));
+        const Clock::time_point start = Clock::now();
+        const int64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        const Clock::time_point sendUntil = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(_options.duration));
+
+        _sending = true;
+        openWindow(start);
+        Clock::time_point nextSend = start;
+        Clock::time_point nextProgress = start + std::chrono::seconds(1);
+        uint64_t progressSent = 0, progressReceived = 0;
+        size_t nextBike = 0;
+        char message[256];
+
+        while (Clock::now() < sendUntil) {
+            // Send every report that is due
+            Clock::time_point now = Clock::now();
+            while (nextSend <= now && nextSend < sendUntil) {
+                Bike& bike = bikes[nextBike];
+                nextBike = (nextBike + 1) % bikes.size();
+
+                const GPSFix& sample = (*bike.track)[bike.position];
+                if (!bike.parked) {
+                    bike.position = (bike.position + 1) % bike.track->size();
+                }
+                nextSend += interval;
+                _samples++;
+
+                GPSFix fix{sample.lat + bike.offset.lat, sample.lon + bike.offset.lon};
+                if (!_options.adaptive) {
+                    fix.lat += jitter(_random);
+                    fix.lon += jitter(_random);
+                } else if (bike.policy.evaluate(fix, 0, now) == ReportReason::None) {
+                    continue;
+                }
+                int64_t sampleMs = startMs + std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+                size_t length = encode(message, sizeof(message), bike.id, fix.lat, fix.lon, sampleMs);
+
+                if (now - _windows.back().opened >= Window) {
+                    openWindow(now);
+                }
+                SocketWindow& window = _windows.back();
+                window.pending.push_back(Clock::now());
+                if (window.socket->sendto(message, length, 0, _gateway) <= 0) {
+                    _sendErrors++;
+                }
+                _sent++;
+            }
+
+            receiveResponses();
+
+            if (now >= nextProgress) {
+                std::fprintf(stderr, "sent %llu/s, received %llu/s\n",
+                    static_cast<unsigned long long>(_sent - progressSent),
+                    static_cast<unsigned long long>(_received - progressReceived));
+                progressSent = _sent;
+                progressReceived = _received;
+                nextProgress += std::chrono::seconds(1);
+            }
+
+            // Sleep when well ahead of schedule, otherwise keep polling for responses
+            if (nextSend - Clock::now() > std::chrono::milliseconds(1)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+        const Clock::time_point sendEnd = Clock::now();
+        _sending = false;
+
+        // Wait for the last responses; each window gives up after drainTimeout
+        while (!_windows.empty()) {
+            if (!receiveResponses()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+        report(std::chrono::duration<double>(sendEnd - start).count());
+        return _received > 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // The reports sent from one socket, answered in the order they were sent
+    struct SocketWindow {
+        std::unique_ptr<sim::socket> socket;
+        Clock::time_point opened;
+        std::deque<Clock::time_point> pending; // Send times of unanswered reports, oldest first
+        std::vector<uint32_t> latencies; // Microseconds, counted once the window is fully answered
+    };
+
+    struct Bike {
+        int id;
+        const std::vector<GPSFix>* track;
+        size_t position;
+        bool parked;
+        GPSFix offset{0, 0}; // Fixed jitter in adaptive mode
+        ReportPolicy policy;
+    };
+
+    LoadOptions _options;
+    struct sockaddr_in _gateway;
+    std::mt19937_64 _random;
+    std::vector<std::vector<GPSFix>> _tracks;
+    std::deque<SocketWindow> _windows; // Oldest first; the last one is sent from
+    std::vector<uint32_t> _latencies; // Microseconds, from windows without loss
+    uint64_t _lossyWindows = 0; // Windows whose latencies were left out
+    bool _sending = false; // Whether the last window is still being sent from
+    uint64_t _samples = 0; // GPS samples taken, sent or not
+    uint64_t _sent = 0;
+    uint64_t _received = 0;
+    uint64_t _errors = 0; // Responses reporting an error
+    uint64_t _sendErrors = 0;
+
+    // Read every track matching the glob through the HAL
+    void loadTracks() {
+        glob_t matches;
+        if (glob(_options.tracks.c_str(), 0, nullptr, &matches) != 0) {
+            throw std::runtime_error("No tracks match " + _options.tracks);
+        }
+
+        for (size_t i = 0; i < matches.gl_pathc; ++i) {
+            CSVHALManager halManager(1);
+            halManager.attachDevice(0, std::make_shared<GPSSensor>());
+            halManager.initialise(matches.gl_pathv[i]);
+
+            std::vector<GPSFix> track;
+            try {
+                while (true) {
+                    track.push_back(halManager.readAs<GPSFix>(0));
+                }
+            } catch (const std::out_of_range&) {
+                // End of the track
+            }
+            if (!track.empty()) {
+                _tracks.push_back(std::move(track));
+            }
+        }
+        globfree(&matches);
+
+        if (_tracks.empty()) {
+            throw std::runtime_error("No track data in " + _options.tracks);
+        }
+    }
+
+    size_t encode(char* buffer, size_t size, int id, double lat, double lon, int64_t sampleMs) const {
+        if (_options.binary) {
+            BinaryProtocol::PositionReport report{id, lat, lon, 0, sampleMs};
+            return BinaryProtocol::encodePosition(reinterpret_cast<uint8_t*>(buffer), report);
+        }
+        return encodePositionJSON(buffer, size, id, lat, lon, sampleMs);
+    }
+
+    void openWindow(Clock::time_point now) {
+        _windows.emplace_back();
+        _windows.back().socket.reset(new sim::socket(AF_INET, SOCK_DGRAM, 0));
+        _windows.back().opened = now;
+    }
+
+    // Take every response already queued and retire the windows that are
+    // done with; returns false if there was no response
+    bool receiveResponses() {
+        bool any = false;
+        for (SocketWindow& window : _windows) {
+            any |= receiveResponses(window);
+        }
+
+        // Every window but the one being sent from is retired once answered
+        // or, having lost a report, once drainTimeout has passed
+        const Clock::duration timeout = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(_options.drainTimeout));
+        Clock::time_point now = Clock::now();
+        while (!_windows.empty() && (_windows.size() > 1 || !_sending)) {
+            SocketWindow& window = _windows.front();
+            if (window.pending.empty()) {
+                _latencies.insert(_latencies.end(), window.latencies.begin(), window.latencies.end());
+            } else if (now - window.pending.back() >= timeout) {
+                _lossyWindows++;
+            } else {
+                break;
+            }
+            _windows.pop_front();
+        }
+        return any;
+    }
+
+    bool receiveResponses(SocketWindow& window) {
+        bool any = false;
+        char response[256];
+        struct sockaddr_in from;
+        while (true) {
+            ssize_t bytes;
+            try {
+                bytes = window.socket->recvfrom(response, sizeof(response), MSG_DONTWAIT, from);
+            } catch (const std::exception&) {
+                // Nothing queued
+                break;
+            }
+            if (bytes <= 0) {
+                break;
+            }
+            any = true;
+            _received++;
+            if (static_cast<size_t>(bytes) >= 5 && std::memcmp(response, "ERROR", 5) == 0) {
+                _errors++;
+            }
+            if (!window.pending.empty()) {
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - window.pending.front());
+                window.latencies.push_back(static_cast<uint32_t>(latency.count()));
+                window.pending.pop_front();
+            }
+        }
+        return any;
+    }
+
+    uint32_t percentile(double fraction) const {
+        if (_latencies.empty()) {
+            return 0;
+        }
+        size_t index = static_cast<size_t>(fraction * (_latencies.size() - 1) + 0.5);
+        return _latencies[index];
+    }
+
+    void report(double seconds) {
+        std::sort(_latencies.begin(), _latencies.end());
+        uint64_t lost = _sent > _received ? _sent - _received : 0;
+
+        std::printf("bikes:          %d (IDs %d-%d) over %zu tracks\n", _options.bikes, _options.idOffset,
+            _options.idOffset + _options.bikes - 1, _tracks.size());
+        std::printf("target rate:    %.0f samples/s (%s, %s)\n", _options.rate, _options.binary ? "binary" : "json",
+            _options.adaptive ? "adaptive" : "every sample");
+        std::printf("sent:           %llu in %.2f s (%.0f reports/s)\n",
+            static_cast<unsigned long long>(_sent), seconds, seconds > 0 ? _sent / seconds : 0.0);
+        std::printf("held back:      %llu of %llu samples (%.1f%%)\n",
+            static_cast<unsigned long long>(_samples - _sent), static_cast<unsigned long long>(_samples),
+            _samples > 0 ? 100.0 * (_samples - _sent) / _samples : 0.0);
+        std::printf("responses:      %llu (%llu errors, %llu send failures)\n",
+            static_cast<unsigned long long>(_received), static_cast<unsigned long long>(_errors),
+            static_cast<unsigned long long>(_sendErrors));
+        std::printf("loss:           %llu (%.3f%%)\n", static_cast<unsigned long long>(lost),
+            _sent > 0 ? 100.0 * lost / _sent : 0.0);
+        std::printf("latency (us):   p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+            percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+            _latencies.empty() ? 0 : _latencies.back());
+        std::printf("                over %zu responses (%llu windows with loss left out)\n", _latencies.size(),
+            static_cast<unsigned long long>(_lossyWindows));
+    }
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,298 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include "Numbers.h"
+
+enum class LogLevel : uint8_t {
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+    Off = 4
+};
+
+inline const char* logLevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Warning: return "WARN";
+    case LogLevel::Error: return "ERROR";
+    default: return "OFF";
+    }
+}
+
+// Parse "debug", "info", "warning", "error" or "off"; returns false if unknown
+inline bool parseLogLevel(const std::string& name, LogLevel& level) {
+    if (name == "debug") level = LogLevel::Debug;
+    else if (name == "info") level = LogLevel::Info;
+    else if (name == "warning" || name == "warn") level = LogLevel::Warning;
+    else if (name == "error") level = LogLevel::Error;
+    else if (name == "off") level = LogLevel::Off;
+    else return false;
+    return true;
+}
+
+// Logger: Asynchronous, level-filtered logging.
+// Callers format a line into a fixed-size buffer on their own stack and
+// push it into a bounded lock-free ring buffer (multi-producer, single
+// consumer). A background thread adds the timestamp, writes the lines and
+// flushes once per batch. When the ring is full, lines are dropped and
+// counted rather than blocking the caller.
+//
+// Debug lines can be sampled so only one in N is kept under load.
+class Logger {
+public:
+    static const size_t MaxLineLength = 240;
+    static const size_t Capacity = 8192; // Ring slots, a power of two
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void setLevel(LogLevel level) {
+        _level.store(level, std::memory_order_relaxed);
+    }
+
+    LogLevel level() const {
+        return _level.load(std::memory_order_relaxed);
+    }
+
+    // Keep one in every `rate` debug lines (1 keeps them all)
+    void setDebugSampleRate(uint32_t rate) {
+        _debugSampleRate.store(rate == 0 ? 1 : rate, std::memory_order_relaxed);
+    }
+
+    // Cheap check made before any formatting
+    bool shouldLog(LogLevel level) {
+        if (level < _level.load(std::memory_order_relaxed) || level == LogLevel::Off) {
+            return false;
+        }
+        if (level == LogLevel::Debug) {
+            uint32_t rate = _debugSampleRate.load(std::memory_order_relaxed);
+            if (rate > 1 && _debugCounter.fetch_add(1, std::memory_order_relaxed) % rate != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Queue a formatted line; never blocks
+    void push(LogLevel level, const char* text, size_t length) {
+        uint64_t position = _enqueuePosition.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &_slots[position & (Capacity - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+            if (difference == 0) {
+                if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                // Ring is full
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                position = _enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->level = level;
+        slot->time = std::chrono::system_clock::now();
+        slot->length = static_cast<uint16_t>(length < MaxLineLength ? length : MaxLineLength);
+        std::memcpy(slot->text, text, slot->length);
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        if (_writerSleeping.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(_wakeMutex);
+            _wake.notify_one();
+        }
+    }
+
+    // Write everything queued so far and stop the background thread
+    void shutdown() {
+        if (!_running.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_wakeMutex);
+            _wake.notify_one();
+        }
+        if (_writerThread.joinable()) {
+            _writerThread.join();
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        LogLevel level;
+        uint16_t length;
+        std::chrono::system_clock::time_point time;
+        char text[MaxLineLength];
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    alignas(64) std::atomic<uint64_t> _enqueuePosition{0};
+    alignas(64) uint64_t _dequeuePosition = 0; // Writer thread only
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<LogLevel> _level{LogLevel::Info};
+    std::atomic<uint32_t> _debugSampleRate{1};
+    std::atomic<uint32_t> _debugCounter{0};
+    std::atomic<bool> _running{true};
+    std::atomic<bool> _writerSleeping{false};
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+    std::thread _writerThread;
+
+    Logger() : _slots(new Slot[Capacity]) {
+        for (size_t i = 0; i < Capacity; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _writerThread = std::thread(&Logger::writerLoop, this);
+    }
+
+    ~Logger() {
+        shutdown();
+    }
+
+    // Write every line available; returns the number written
+    size_t drain() {
+        size_t written = 0;
+        while (true) {
+            Slot& slot = _slots[_dequeuePosition & (Capacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != _dequeuePosition + 1) {
+                break;
+            }
+            writeLine(slot);
+            slot.sequence.store(_dequeuePosition + Capacity, std::memory_order_release);
+            _dequeuePosition++;
+            written++;
+        }
+
+        uint64_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            std::fprintf(stderr, "[logger] %llu log lines dropped\n", static_cast<unsigned long long>(dropped));
+        }
+        if (written > 0 || dropped > 0) {
+            std::fflush(stdout);
+            std::fflush(stderr);
+        }
+        return written;
+    }
+
+    void writeLine(const Slot& slot) {
+        std::time_t seconds = std::chrono::system_clock::to_time_t(slot.time);
+        int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            slot.time.time_since_epoch()).count() % 1000);
+        std::tm tmBuffer;
+        localtime_r(&seconds, &tmBuffer);
+        char timeText[32];
+        strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", &tmBuffer);
+
+        FILE* stream = slot.level >= LogLevel::Warning ? stderr : stdout;
+        std::fprintf(stream, "[%s.%03d] %-5s %.*s\n", timeText, millis, logLevelName(slot.level),
+                     static_cast<int>(slot.length), slot.text);
+    }
+
+    void writerLoop() {
+        while (_running.load(std::memory_order_acquire)) {
+            if (drain() > 0) {
+                continue;
+            }
+
+            // Nothing queued: sleep until a producer wakes us or a short timeout
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            _writerSleeping.store(true, std::memory_order_release);
+            _wake.wait_for(lock, std::chrono::milliseconds(50));
+            _writerSleeping.store(false, std::memory_order_release);
+        }
+        drain();
+    }
+};
+
+// LogLine: Builds one log line in a stack buffer and queues it when it
+// goes out of scope. Nothing is allocated on the heap.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : _level(level), _length(0) {}
+
+    ~LogLine() {
+        Logger::instance().push(_level, _text, _length);
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(const char* text) {
+        append(text, std::strlen(text));
+        return *this;
+    }
+
+    LogLine& operator<<(char* text) {
+        return *this << static_cast<const char*>(text);
+    }
+
+    LogLine& operator<<(const std::string& text) {
+        append(text.data(), text.size());
+        return *this;
+    }
+
+    LogLine& operator<<(char c) {
+        append(&c, 1);
+        return *this;
+    }
+
+    template <typename T>
+    LogLine& operator<<(T value) {
+        char buffer[Numbers::MaxLength];
+        append(buffer, static_cast<size_t>(Numbers::format(buffer, value) - buffer));
+        return *this;
+    }
+
+private:
+    LogLevel _level;
+    size_t _length;
+    char _text[Logger::MaxLineLength];
+
+    void append(const char* text, size_t length) {
+        size_t space = Logger::MaxLineLength - _length;
+        if (length > space) {
+            length = space;
+        }
+        std::memcpy(_text + _length, text, length);
+        _length += length;
+    }
+};
+
+// Format and queue a line only if its level is enabled, e.g.
+//   LOG_INFO("Socket server running on port " << port);
+#define LOG_AT(level, expression) \
+    do { \
+        if (Logger::instance().shouldLog(level)) { \
+            LogLine logLine_(level); \
+            logLine_ << expression; \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(expression) LOG_AT(LogLevel::Debug, expression)
+#define LOG_INFO(expression) LOG_AT(LogLevel::Info, expression)
+#define LOG_WARNING(expression) LOG_AT(LogLevel::Warning, expression)
+#define LOG_ERROR(expression) LOG_AT(LogLevel::Error, expression)
+
+#endif // LOGGER_H
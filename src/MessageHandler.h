@@ -1,9 +1,10 @@
 #ifndef MESSAGEHANDLER_H
 #define MESSAGEHANDLER_H
 
-#include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <cstring>
 #include <arpa/inet.h>
 #include <Poco/JSON/Parser.h>
@@ -11,14 +12,62 @@
 #include <Poco/JSON/Array.h>
 #include <Poco/Dynamic/Var.h>
 #include "sim/socket.h"
+#include "FleetStore.h"
+#include "BinaryProtocol.h"
+#include "IngestWorkers.h"
+#include "Numbers.h"
+#include "Logger.h"
+#include "Metrics.h"
 
 class MessageHandler {
 public:
-    MessageHandler(Poco::JSON::Array::Ptr& ebikes) : _ebikes(ebikes) {}
+    // Position reports go to the ingest workers when given, otherwise
+    // straight to the fleet
+    MessageHandler(FleetStore& fleet, IngestWorkers* workers = nullptr)
+        : _fleet(fleet), _workers(workers),
+          _jsonMessages(Metrics::instance().counter("gateway_messages_total",
+              "Messages handled, by wire format", "format=\"json\"")),
+          _binaryMessages(Metrics::instance().counter("gateway_messages_total",
+              "Messages handled, by wire format", "format=\"binary\"")),
+          _parseErrors(Metrics::instance().counter("gateway_parse_errors_total",
+              "Messages that could not be parsed or decoded")),
+          _unknownTypes(Metrics::instance().counter("gateway_unknown_message_types_total",
+              "Messages of an unknown type")),
+          _positionReports(Metrics::instance().counter("gateway_position_reports_total",
+              "Position reports queued for the fleet")),
+          _maintenanceRequests(Metrics::instance().counter("gateway_maintenance_requests_total",
+              "Maintenance requests handled")),
+          _sendFailures(Metrics::instance().counter("gateway_response_send_failures_total",
+              "Responses that could not be sent")) {}
 
-    // Handle incoming messages and return an appropriate response
-    const char* handleMessage(const char* message, const char* clientIp, uint16_t clientPort) {
-        std::cout << "Handling message from " << clientIp << ":" << clientPort << " - " << message << std::endl;
+    // Handle incoming messages and return an appropriate response.
+    // Binary messages are recognised by their magic byte; anything else is
+    // parsed as JSON, which must be null-terminated.
+    //
+    // Position reports are queued and applied to the fleet together by
+    // flush(), which must be called before the responses are sent.
+    const char* handleMessage(const char* message, size_t length, const char* clientIp, uint16_t clientPort) {
+        if (BinaryProtocol::isBinary(message, length)) {
+            _binaryMessages.increment();
+            LOG_DEBUG("Handling binary message (" << length << " bytes) from " << clientIp << ":" << clientPort);
+            return handleBinaryMessage(message, length);
+        }
+
+        _jsonMessages.increment();
+        LOG_DEBUG("Handling message from " << clientIp << ":" << clientPort << " - " << message);
+
+        // Plain position reports are read without building a JSON object
+        PositionUpdate update;
+        if (scanPosition(message, message + length, update)) {
+            if (!isValidPosition(update.lat, update.lon)) {
+                _parseErrors.increment();
+                return "ERROR: Invalid position";
+            }
+            _pending.push_back(update);
+            LOG_DEBUG("Updated eBike ID " << update.id << " at " << update.lat << ", " << update.lon <<
+                " with status " << statusToString(update.status));
+            return "OK";
+        }
         
         try {
             // Parse the incoming JSON message
@@ -28,8 +77,12 @@ public:
             
             // Check if this is a position update
             if (jsonObject->has("type") && jsonObject->getValue<std::string>("type") == "position") {
-                processPositionUpdate(jsonObject, clientIp);
-                return "OK";
+                return processPositionUpdate(jsonObject, clientIp);
+            }
+            
+            // Check if this is a batch of position updates
+            if (jsonObject->has("type") && jsonObject->getValue<std::string>("type") == "batch") {
+                return processPositionBatch(jsonObject);
             }
             
             // Check if this is a maintenance request
@@ -38,13 +91,30 @@ public:
             }
             
             // Unknown message type
+            _unknownTypes.increment();
             return "ERROR: Unknown message type";
         } catch (const std::exception& e) {
-            std::cerr << "Error parsing message: " << e.what() << std::endl;
+            _parseErrors.increment();
+            LOG_WARNING("Error parsing message: " << e.what());
             return "ERROR: Invalid message format";
         }
     }
 
+    // Apply all queued position reports to the fleet, taking each shard's
+    // lock once, or hand them to the ingest workers
+    void flush() {
+        if (_pending.empty()) {
+            return;
+        }
+        _positionReports.increment(_pending.size());
+        if (_workers) {
+            _workers->submit(_pending.data(), _pending.size());
+        } else {
+            _fleet.updatePositions(_pending.data(), _pending.size());
+        }
+        _pending.clear();
+    }
+
     void sendResponse(sim::socket* serverSocket, const char* response, const struct sockaddr_in& clientAddr) {
         ssize_t sent = serverSocket->sendto(response, strlen(response), 0, clientAddr);
 
@@ -53,74 +123,226 @@ public:
         inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, sizeof(clientIp));
         uint16_t clientPort = ntohs(clientAddr.sin_port);
 
-        std::cout << "Server: " << response << " sent to client: " << clientIp << ":" << clientPort << std::endl;
+        LOG_DEBUG("Server: " << response << " sent to client: " << clientIp << ":" << clientPort);
 
         if (sent > 0) {
-            std::cout << "Response sent to client: " << response << std::endl;
+            LOG_DEBUG("Response sent to client: " << response);
+        } else {
+            _sendFailures.increment();
         }
     }
 
 private:
-    Poco::JSON::Array::Ptr& _ebikes;
+    FleetStore& _fleet;
+    IngestWorkers* _workers;
+    std::vector<PositionUpdate> _pending; // Position reports waiting for flush()
+    Counter& _jsonMessages;
+    Counter& _binaryMessages;
+    Counter& _parseErrors;
+    Counter& _unknownTypes;
+    Counter& _positionReports;
+    Counter& _maintenanceRequests;
+    Counter& _sendFailures;
+
+    // Decode a binary message in place and apply it to the fleet
+    const char* handleBinaryMessage(const char* message, size_t length) {
+        if (!BinaryProtocol::hasSupportedVersion(message)) {
+            _parseErrors.increment();
+            return "ERROR: Unsupported protocol version";
+        }
+
+        switch (BinaryProtocol::messageType(message)) {
+        case BinaryProtocol::MessageType::Position: {
+            BinaryProtocol::PositionReport report;
+            if (!BinaryProtocol::decodePosition(message, length, report)) {
+                _parseErrors.increment();
+                return "ERROR: Invalid message format";
+            }
+            if (!isValidPosition(report.lat, report.lon)) {
+                _parseErrors.increment();
+                return "ERROR: Invalid position";
+            }
+            EBikeStatus status = report.status ? EBikeStatus::Locked : EBikeStatus::Unlocked;
+            _pending.push_back({report.id, report.lat, report.lon, status, report.sampleMs});
+
+            LOG_DEBUG("Updated eBike ID " << report.id << " at " << report.lat << ", " << report.lon <<
+                " with status " << statusToString(status));
+            return "OK";
+        }
+        case BinaryProtocol::MessageType::PositionBatch:
+        case BinaryProtocol::MessageType::TimedPositionBatch: {
+            size_t count;
+            if (!BinaryProtocol::batchCount(message, length, count)) {
+                _parseErrors.increment();
+                return "ERROR: Invalid message format";
+            }
+            // A batch is applied whole or not at all
+            size_t queued = _pending.size();
+            BinaryProtocol::PositionReport report;
+            for (size_t i = 0; i < count; ++i) {
+                BinaryProtocol::decodeBatchRecord(message, i, report);
+                if (!isValidPosition(report.lat, report.lon)) {
+                    _pending.resize(queued);
+                    _parseErrors.increment();
+                    return "ERROR: Invalid position";
+                }
+                _pending.push_back({report.id, report.lat, report.lon,
+                    report.status ? EBikeStatus::Locked : EBikeStatus::Unlocked, report.sampleMs});
+            }
+
+            LOG_DEBUG("Queued batch of " << count << " eBike positions");
+            return "OK";
+        }
+        case BinaryProtocol::MessageType::Maintenance: {
+            BinaryProtocol::MaintenanceRequest request;
+            if (!BinaryProtocol::decodeMaintenance(message, length, request)) {
+                _parseErrors.increment();
+                return "ERROR: Invalid message format";
+            }
+            return applyMaintenance(request.id, request.action);
+        }
+        }
+
+        _unknownTypes.increment();
+        return "ERROR: Unknown message type";
+    }
+
+    static const char* skipSpace(const char* p, const char* end) {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            ++p;
+        }
+        return p;
+    }
+
+    // Read a JSON string without escapes; returns the end of it, or nullptr
+    static const char* scanString(const char* p, const char* end, std::string_view& text) {
+        if (p == end || *p != '"') {
+            return nullptr;
+        }
+        const char* start = ++p;
+        while (p != end && *p != '"') {
+            if (*p == '\\') {
+                return nullptr;
+            }
+            ++p;
+        }
+        if (p == end) {
+            return nullptr;
+        }
+        text = std::string_view(start, static_cast<size_t>(p - start));
+        return p + 1;
+    }
+
+    // Read a flat position report, {"type":"position","id":..,"lat":..,
+    // "lon":..,"sampleTime":..,"status":".."} with its keys in any order
+    // and the sample time optional, parsing the numbers in place. Returns
+    // false for anything else (other message types, other keys, escapes,
+    // numbers as strings), which is left to the full JSON parser.
+    static bool scanPosition(const char* p, const char* end, PositionUpdate& update) {
+        bool isPosition = false, hasId = false, hasLat = false, hasLon = false;
+        update.status = EBikeStatus::Unlocked;
+
+        p = skipSpace(p, end);
+        if (p == end || *p++ != '{') {
+            return false;
+        }
+        while (true) {
+            std::string_view key;
+            p = scanString(skipSpace(p, end), end, key);
+            if (!p) {
+                return false;
+            }
+            p = skipSpace(p, end);
+            if (p == end || *p++ != ':') {
+                return false;
+            }
+            p = skipSpace(p, end);
+
+            std::string_view text;
+            if (key == "type") {
+                p = scanString(p, end, text);
+                isPosition = text == "position";
+            } else if (key == "status") {
+                p = scanString(p, end, text);
+                update.status = text == "locked" ? EBikeStatus::Locked : EBikeStatus::Unlocked;
+            } else if (key == "id") {
+                p = Numbers::parse(p, end, update.id);
+                hasId = true;
+            } else if (key == "lat") {
+                p = Numbers::parse(p, end, update.lat);
+                hasLat = true;
+            } else if (key == "lon") {
+                p = Numbers::parse(p, end, update.lon);
+                hasLon = true;
+            } else if (key == "sampleTime") {
+                p = Numbers::parse(p, end, update.sampleMs);
+            } else {
+                return false;
+            }
+            if (!p) {
+                return false;
+            }
+
+            p = skipSpace(p, end);
+            if (p != end && *p == ',') {
+                ++p;
+                continue;
+            }
+            if (p == end || *p++ != '}') {
+                return false;
+            }
+            break;
+        }
+        return skipSpace(p, end) == end && isPosition && hasId && hasLat && hasLon;
+    }
 
     // Process position update from an eBike
-    void processPositionUpdate(Poco::JSON::Object::Ptr& jsonObject, const char* clientIp) {
+    const char* processPositionUpdate(Poco::JSON::Object::Ptr& jsonObject, const char* clientIp) {
         int id = jsonObject->getValue<int>("id");
         double lat = jsonObject->getValue<double>("lat");
         double lon = jsonObject->getValue<double>("lon");
         std::string status = jsonObject->has("status") ? 
             jsonObject->getValue<std::string>("status") : "unlocked";
+        int64_t sampleMs = jsonObject->has("sampleTime") ? jsonObject->getValue<int64_t>("sampleTime") : 0;
+        if (!isValidPosition(lat, lon)) {
+            _parseErrors.increment();
+            return "ERROR: Invalid position";
+        }
         
-        // Create timestamp
-        auto now = std::chrono::system_clock::now();
-        auto now_time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm* now_tm = std::localtime(&now_time_t);
-        char timeBuffer[26];
-        strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", now_tm);
-        
-        // Create the GeoJSON Feature for the eBike
-        Poco::JSON::Object::Ptr feature = new Poco::JSON::Object;
-        Poco::JSON::Object::Ptr geometry = new Poco::JSON::Object;
-        Poco::JSON::Array::Ptr coordinates = new Poco::JSON::Array;
-        Poco::JSON::Object::Ptr properties = new Poco::JSON::Object;
-        
-        // Set the geometry (Point with coordinates)
-        geometry->set("type", "Point");
-        coordinates->add(lon);
-        coordinates->add(lat);
-        geometry->set("coordinates", coordinates);
-        
-        // Set the properties
-        properties->set("id", id);
-        properties->set("status", status);
-        properties->set("timestamp", std::string(timeBuffer));
-        
-        // Assemble the feature
-        feature->set("type", "Feature");
-        feature->set("geometry", geometry);
-        feature->set("properties", properties);
+        // Queue the update for the eBike in the fleet
+        _pending.push_back({id, lat, lon, statusFromString(status), sampleMs});
         
-        // Update or add the eBike to the array
-        bool updated = false;
-        for (int i = 0; i < _ebikes->size(); i++) {
-            Poco::JSON::Object::Ptr obj = _ebikes->getObject(i);
-            Poco::JSON::Object::Ptr props = obj->getObject("properties");
-            
-            if (props->getValue<int>("id") == id) {
-                // Update existing eBike
-                _ebikes->set(i, feature);
-                updated = true;
-                break;
-            }
+        LOG_DEBUG("Updated eBike ID " << id << " at " << lat << ", " << lon << 
+            " with status " << status);
+        return "OK";
+    }
+
+    // Process a batch of position updates: {"type":"batch","positions":[...]}
+    const char* processPositionBatch(Poco::JSON::Object::Ptr& jsonObject) {
+        Poco::JSON::Array::Ptr positions = jsonObject->getArray("positions");
+        if (!positions) {
+            return "ERROR: Missing positions";
         }
-        
-        // If no existing eBike was found, add a new one
-        if (!updated) {
-            _ebikes->add(feature);
+
+        // A batch is applied whole or not at all
+        size_t queued = _pending.size();
+        for (size_t i = 0; i < positions->size(); ++i) {
+            Poco::JSON::Object::Ptr position = positions->getObject(static_cast<unsigned>(i));
+            std::string status = position->has("status") ?
+                position->getValue<std::string>("status") : "unlocked";
+            PositionUpdate update{position->getValue<int>("id"), position->getValue<double>("lat"),
+                position->getValue<double>("lon"), statusFromString(status),
+                position->has("sampleTime") ? position->getValue<int64_t>("sampleTime") : 0};
+            if (!isValidPosition(update.lat, update.lon)) {
+                _pending.resize(queued);
+                _parseErrors.increment();
+                return "ERROR: Invalid position";
+            }
+            _pending.push_back(update);
         }
-        
-        std::cout << "Updated eBike ID " << id << " at " << lat << ", " << lon << 
-            " with status " << status << std::endl;
+
+        LOG_DEBUG("Queued batch of " << positions->size() << " eBike positions");
+        return "OK";
     }
 
     // Process maintenance request
@@ -134,38 +356,50 @@ private:
             jsonObject->getValue<std::string>("action") : "";
         
         if (action == "lock") {
-            // Process lock request
-            updateEBikeStatus(id, "locked");
-            return "OK: eBike locked";
+            return applyMaintenance(id, BinaryProtocol::MaintenanceAction::Lock);
         } else if (action == "unlock") {
-            // Process unlock request
-            updateEBikeStatus(id, "unlocked");
-            return "OK: eBike unlocked";
+            return applyMaintenance(id, BinaryProtocol::MaintenanceAction::Unlock);
+        } else if (action == "remove") {
+            return applyMaintenance(id, BinaryProtocol::MaintenanceAction::Remove);
         } else {
             return "ERROR: Unknown maintenance action";
         }
     }
 
-    // Update eBike status in the array
-    void updateEBikeStatus(int id, const std::string& status) {
-        for (int i = 0; i < _ebikes->size(); i++) {
-            Poco::JSON::Object::Ptr feature = _ebikes->getObject(i);
-            Poco::JSON::Object::Ptr properties = feature->getObject("properties");
-            
-            if (properties->getValue<int>("id") == id) {
-                properties->set("status", status);
-                
-                // Update timestamp
-                auto now = std::chrono::system_clock::now();
-                auto now_time_t = std::chrono::system_clock::to_time_t(now);
-                std::tm* now_tm = std::localtime(&now_time_t);
-                char timeBuffer[26];
-                strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", now_tm);
-                properties->set("timestamp", std::string(timeBuffer));
-                
-                std::cout << "Updated eBike ID " << id << " status to " << status << std::endl;
-                break;
+    // Apply a maintenance action from either message format
+    const char* applyMaintenance(int id, BinaryProtocol::MaintenanceAction action) {
+        _maintenanceRequests.increment();
+
+        // Keep the order of queued position reports and this request
+        flush();
+        if (_workers) {
+            _workers->waitForShard(id);
+        }
+
+        switch (action) {
+        case BinaryProtocol::MaintenanceAction::Lock:
+            // Process lock request
+            updateEBikeStatus(id, EBikeStatus::Locked);
+            return "OK: eBike locked";
+        case BinaryProtocol::MaintenanceAction::Unlock:
+            // Process unlock request
+            updateEBikeStatus(id, EBikeStatus::Unlocked);
+            return "OK: eBike unlocked";
+        case BinaryProtocol::MaintenanceAction::Remove:
+            // Take the eBike out of the fleet
+            if (!_fleet.remove(id)) {
+                return "ERROR: Unknown eBike ID";
             }
+            LOG_DEBUG("Removed eBike ID " << id);
+            return "OK: eBike removed";
+        }
+        return "ERROR: Unknown maintenance action";
+    }
+
+    // Update eBike status in the fleet
+    void updateEBikeStatus(int id, EBikeStatus status) {
+        if (_fleet.updateStatus(id, status)) {
+            LOG_DEBUG("Updated eBike ID " << id << " status to " << statusToString(status));
         }
     }
 };
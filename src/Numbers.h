@@ -0,0 +1,200 @@
+#ifndef NUMBERS_H
+#define NUMBERS_H
+
+#include <string>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+// Numbers: Allocation-free parsing and formatting of the numbers the
+// gateway moves around, mostly coordinates with a handful of decimals.
+//
+// Both directions are exact: parse() returns the double nearest to the
+// decimal text, and format() writes the shortest text that parses back to
+// the same double. Common cases take a fast path and anything else (long
+// mantissas, exponents, huge values) falls back to std::from_chars and
+// std::to_chars, which give the same results.
+namespace Numbers {
+
+// Longest text format() writes
+const size_t MaxLength = 32;
+
+namespace detail {
+
+// Powers of ten that are exact doubles
+const double ExactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Write the decimal digits of a value, most significant first; returns the end
+inline char* writeDigits(char* out, uint64_t value) {
+    char digits[20];
+    char* start = digits + sizeof(digits);
+    do {
+        *--start = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    size_t length = static_cast<size_t>(digits + sizeof(digits) - start);
+    std::memcpy(out, start, length);
+    return out + length;
+}
+
+// Decimal places tried by the formatting fast path, and their scale
+const int FastDecimals = 6;
+const double FastScale = 1e6;
+
+}
+
+// Parse a decimal number at the start of [first, last). Returns the end of
+// the number, or nullptr if there is none. Like std::from_chars, there is
+// no leading '+' or whitespace; as in JSON, a '.' needs digits on both
+// sides, and nan, inf and values too large for a double are not numbers.
+inline const char* parse(const char* first, const char* last, double& value) {
+    // Fast path (Clinger): a mantissa and a power of ten that are both
+    // exact doubles give the correctly rounded result in one division
+    const char* p = first;
+    bool negative = p != last && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    const char* start = p;
+    while (p != last && static_cast<unsigned>(*p - '0') < 10) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+        ++digits;
+        ++p;
+    }
+    if (p == start) {
+        return nullptr;
+    }
+    if (p != last && *p == '.') {
+        ++p;
+        const char* fraction = p;
+        while (p != last && static_cast<unsigned>(*p - '0') < 10) {
+            mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+            ++digits;
+            ++p;
+        }
+        decimals = static_cast<int>(p - fraction);
+        if (decimals == 0) {
+            return nullptr;
+        }
+    }
+    bool exponent = p != last && (*p == 'e' || *p == 'E');
+    if (digits <= 15 && decimals <= 22 && !exponent) {
+        double result = static_cast<double>(mantissa) / detail::ExactPowers[decimals];
+        value = negative ? -result : result;
+        return p;
+    }
+
+    double result;
+    auto parsed = std::from_chars(first, last, result);
+    if (parsed.ec != std::errc() || !std::isfinite(result)) {
+        return nullptr;
+    }
+    value = result;
+    return parsed.ptr;
+}
+
+// Parse an integer at the start of [first, last); returns the end of the
+// number, or nullptr if there is none or it is out of range
+template <typename Integer>
+const char* parse(const char* first, const char* last, Integer& value) {
+    static_assert(std::is_integral<Integer>::value, "parse() takes integers or doubles");
+    auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Parse the whole of [first, last) as a number; returns false if any of it is not
+template <typename Number>
+bool parseAll(const char* first, const char* last, Number& value) {
+    return first != last && parse(first, last, value) == last;
+}
+
+template <typename Number>
+bool parseAll(const std::string& text, Number& value) {
+    return parseAll(text.data(), text.data() + text.size(), value);
+}
+
+// Write the shortest text that parses back to the same double into a
+// buffer of at least MaxLength; returns the end. The text is the same as
+// std::to_chars writes.
+inline char* format(char* out, double value) {
+    // Fast path: a value that is exactly the nearest double to a decimal
+    // with at most six decimals and fifteen digits. Two such decimals never
+    // share a double, so that decimal, without trailing zeros, is the
+    // shortest text for it.
+    double scaled = value * detail::FastScale;
+    if (!(scaled > -1e15 && scaled < 1e15)) {
+        return std::to_chars(out, out + MaxLength, value).ptr;
+    }
+    int64_t units = static_cast<int64_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    if (static_cast<double>(units) / detail::FastScale != value || (units == 0 && std::signbit(value))) {
+        return std::to_chars(out, out + MaxLength, value).ptr;
+    }
+
+    uint64_t magnitude = static_cast<uint64_t>(units < 0 ? -units : units);
+    uint64_t whole = magnitude / 1000000;
+    uint64_t fraction = magnitude % 1000000;
+    int decimals = fraction ? detail::FastDecimals : 0;
+    while (fraction && fraction % 10 == 0) {
+        fraction /= 10;
+        --decimals;
+    }
+
+    // std::to_chars switches to scientific notation when that is shorter,
+    // as it is for 1e+06 and 1.2e-05; leave those to it
+    if (whole == 0 && fraction) {
+        int significant = 0;
+        for (uint64_t rest = fraction; rest; rest /= 10) {
+            ++significant;
+        }
+        if (2 + decimals > significant + (significant > 1) + 4) {
+            return std::to_chars(out, out + MaxLength, value).ptr;
+        }
+    } else if (!fraction && whole >= 100000) {
+        return std::to_chars(out, out + MaxLength, value).ptr;
+    }
+
+    if (units < 0) {
+        *out++ = '-';
+    }
+    out = detail::writeDigits(out, whole);
+    if (decimals) {
+        *out++ = '.';
+        char* end = out + decimals;
+        for (char* digit = end; digit != out;) {
+            *--digit = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        out = end;
+    }
+    return out;
+}
+
+inline char* format(char* out, float value) {
+    return std::to_chars(out, out + MaxLength, value).ptr;
+}
+
+template <typename Integer>
+char* format(char* out, Integer value) {
+    static_assert(std::is_integral<Integer>::value, "format() takes integers or doubles");
+    return std::to_chars(out, out + MaxLength, value).ptr;
+}
+
+// Append the text of a number to a string
+template <typename Number>
+void append(std::string& out, Number value) {
+    char buffer[MaxLength];
+    out.append(buffer, format(buffer, value));
+}
+
+}
+
+#endif // NUMBERS_H
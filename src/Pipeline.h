@@ -0,0 +1,94 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include "Metrics.h"
+
+// What a pipeline stage does when the queue in front of it is full
+enum class OverloadPolicy {
+    DropNewest, // Refuse the new item
+    DropOldest, // Discard the item that has waited longest
+    CoalescePositions // Keep only the latest position per bike, then drop the oldest
+};
+
+inline bool parseOverloadPolicy(const std::string& text, OverloadPolicy& policy) {
+    if (text == "drop-newest") {
+        policy = OverloadPolicy::DropNewest;
+    } else if (text == "drop-oldest") {
+        policy = OverloadPolicy::DropOldest;
+    } else if (text == "coalesce") {
+        policy = OverloadPolicy::CoalescePositions;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Queue sizes and overload policies of the ingest pipeline:
+//
+//   receive -> [datagrams] -> decode -> [positions] -> apply (per shard)
+//                                    -> [responses] -> respond
+struct PipelineOptions {
+    size_t datagramSlots = 1024; // Datagrams received but not yet decoded
+    size_t responseCapacity = 4096; // Responses decoded but not yet sent
+    size_t applyCapacity = 65536; // Position reports queued per ingest worker
+    OverloadPolicy receivePolicy = OverloadPolicy::DropOldest;
+    OverloadPolicy applyPolicy = OverloadPolicy::CoalescePositions;
+    std::chrono::milliseconds coalesceTick{20}; // Longest an ingest worker holds reports to coalesce them
+};
+
+// StageMetrics: Counters of one pipeline stage, labelled with its name.
+// Depth is the number of items queued in front of the stage.
+struct StageMetrics {
+    explicit StageMetrics(const std::string& stage)
+        : processed(Metrics::instance().counter("gateway_pipeline_processed_total",
+              "Items taken off a pipeline stage's queue and processed, by stage", "stage=\"" + stage + "\"")),
+          dropped(Metrics::instance().counter("gateway_pipeline_dropped_total",
+              "Items dropped by a pipeline stage, by stage and reason",
+              "stage=\"" + stage + "\",reason=\"overflow\"")),
+          depth(Metrics::instance().gauge("gateway_pipeline_queue_depth",
+              "Items queued in front of a pipeline stage, by stage", "stage=\"" + stage + "\"")) {}
+
+    Counter& processed;
+    Counter& dropped;
+    Gauge& depth;
+};
+
+// Doorbell: Lets the consumer of a lock-free queue sleep while it is empty.
+// Producers only take the lock when the consumer is actually asleep, so
+// the fast path of ring() is a fence and a load.
+class Doorbell {
+public:
+    // Wake the consumer; call after pushing
+    void ring() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _wake.notify_all();
+        }
+    }
+
+    // Sleep until ready() holds, the doorbell rings or the timeout passes
+    template <typename Predicate>
+    void wait(Predicate ready, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            _wake.wait_for(lock, timeout);
+        }
+        _sleeping.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _sleeping{false};
+};
+
+#endif // PIPELINE_H
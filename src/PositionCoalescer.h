@@ -0,0 +1,55 @@
+#ifndef POSITIONCOALESCER_H
+#define POSITIONCOALESCER_H
+
+#include <vector>
+#include <unordered_map>
+#include "FleetShard.h"
+
+// PositionCoalescer: Collects position reports, keeping only the newest
+// report per bike (latest wins, unless both carry sample times and the
+// later one is of an older fix). A report that changes a bike's status is
+// never merged into the one before it: it is kept as its own entry, so
+// every lock and unlock still reaches the fleet, in order.
+//
+// Entries stay in the order each run of reports first arrived, which
+// keeps the reports of one bike in the order they were received.
+class PositionCoalescer {
+public:
+    // Add a report; returns true if it replaced an earlier report
+    bool add(const PositionUpdate& update) {
+        auto found = _latest.find(update.id);
+        if (found != _latest.end() && _updates[found->second].status == update.status) {
+            PositionUpdate& latest = _updates[found->second];
+            if (update.sampleMs <= 0 || update.sampleMs >= latest.sampleMs) {
+                latest = update;
+            }
+            return true;
+        }
+        _latest[update.id] = _updates.size();
+        _updates.push_back(update);
+        return false;
+    }
+
+    const PositionUpdate* data() const {
+        return _updates.data();
+    }
+
+    size_t size() const {
+        return _updates.size();
+    }
+
+    bool empty() const {
+        return _updates.empty();
+    }
+
+    void clear() {
+        _updates.clear();
+        _latest.clear();
+    }
+
+private:
+    std::vector<PositionUpdate> _updates;
+    std::unordered_map<int, size_t> _latest; // Bike ID -> index of its newest entry
+};
+
+#endif // POSITIONCOALESCER_H
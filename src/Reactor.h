@@ -0,0 +1,231 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// Reactor: An event loop that waits on many file descriptors and timers
+// with one epoll call, on one thread.
+//
+// Descriptors are registered edge-triggered and non-blocking: a handler is
+// called once when its descriptor becomes readable and must read until it
+// would block. A handler that stops early to let others run (returning
+// true) is called again before the loop next sleeps. Timers are timerfds
+// on the same loop, and events are eventfds that other threads signal to
+// have work done on the loop's thread. stop() wakes the loop through an eventfd, so run()
+// returns at once from any thread, even while every descriptor is idle.
+class Reactor {
+public:
+    // Called when a descriptor is readable; returns true if there may be more to read
+    typedef std::function<bool()> ReadHandler;
+    typedef std::function<void()> TimerHandler;
+
+    // Most descriptors handled per epoll_wait
+    static const int MaxEvents = 64;
+
+    Reactor() : _epollFd(epoll_create1(EPOLL_CLOEXEC)), _stopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if (_epollFd < 0 || _stopFd < 0) {
+            closeAll();
+            throw std::runtime_error(std::string("Failed to create event loop: ") + std::strerror(errno));
+        }
+        watch(_stopFd, nullptr);
+    }
+
+    ~Reactor() {
+        closeAll();
+    }
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Call handler whenever fd becomes readable; makes fd non-blocking.
+    // The reactor does not own fd.
+    void addReadable(int fd, ReadHandler handler) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            throw std::runtime_error(std::string("Failed to make descriptor non-blocking: ") + std::strerror(errno));
+        }
+        std::unique_ptr<Source> source(new Source);
+        source->fd = fd;
+        source->onReadable = std::move(handler);
+        watch(fd, source.get());
+        _sources.push_back(std::move(source));
+    }
+
+    // Call handler every interval, first one interval from now
+    void addTimer(std::chrono::milliseconds interval, TimerHandler handler) {
+        if (interval.count() <= 0) {
+            throw std::invalid_argument("Timer interval must be positive.");
+        }
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Failed to create timer: ") + std::strerror(errno));
+        }
+        std::unique_ptr<Source> source(new Source);
+        source->fd = fd;
+        source->ownsFd = true;
+        source->onTimer = std::move(handler);
+
+        struct itimerspec spec;
+        spec.it_interval.tv_sec = interval.count() / 1000;
+        spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
+        Source* timer = source.get();
+        _sources.push_back(std::move(source)); // Closes the timerfd if what follows fails
+        if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+            throw std::runtime_error(std::string("Failed to start timer: ") + std::strerror(errno));
+        }
+        watch(fd, timer);
+    }
+
+    // Call handler on the loop whenever notify() is called with the
+    // returned descriptor; notifications made before the handler runs are
+    // merged into one call. Like a readable handler it returns true to be
+    // called again before the loop sleeps.
+    int addEvent(ReadHandler handler) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Failed to create event: ") + std::strerror(errno));
+        }
+        std::unique_ptr<Source> source(new Source);
+        source->fd = fd;
+        source->ownsFd = true;
+        source->isEvent = true;
+        source->onReadable = std::move(handler);
+        Source* event = source.get();
+        _sources.push_back(std::move(source)); // Closes the eventfd if what follows fails
+        watch(fd, event);
+        return fd;
+    }
+
+    // Signal an event returned by addEvent(); safe to call from any thread
+    static void notify(int event) {
+        uint64_t one = 1;
+        ssize_t written = write(event, &one, sizeof(one));
+        (void)written; // Only fails if the counter is about to overflow, when it is already signalled
+    }
+
+    // Dispatch events until stop() is called. Descriptors found readable
+    // but not yet drained are remembered, so a later run() picks them up.
+    void run() {
+        epoll_event events[MaxEvents];
+        std::vector<Source*>& pending = _pending;
+        std::vector<Source*> again;
+
+        while (true) {
+            // Only sleep when nothing is left to drain
+            int count = epoll_wait(_epollFd, events, MaxEvents, pending.empty() ? -1 : 0);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Event loop failed: ") + std::strerror(errno));
+            }
+
+            bool stopped = false;
+            for (int i = 0; i < count; ++i) {
+                Source* source = static_cast<Source*>(events[i].data.ptr);
+                if (!source) {
+                    // stop() was called; clear it so run() can be called
+                    // again, but first keep the rest of the batch's edges
+                    uint64_t value;
+                    ssize_t cleared = read(_stopFd, &value, sizeof(value));
+                    (void)cleared;
+                    stopped = true;
+                    continue;
+                }
+                if (source->onTimer) {
+                    uint64_t expirations;
+                    if (read(source->fd, &expirations, sizeof(expirations)) > 0) {
+                        source->onTimer();
+                    }
+                } else if (!source->pending) {
+                    pending.push_back(source);
+                    source->pending = true;
+                }
+            }
+            if (stopped) {
+                return;
+            }
+
+            // Give every readable descriptor one turn
+            again.clear();
+            for (Source* source : pending) {
+                if (source->isEvent) {
+                    // Clear the signal first, so one made while the handler runs is not lost
+                    uint64_t value;
+                    ssize_t cleared = read(source->fd, &value, sizeof(value));
+                    (void)cleared;
+                }
+                if (source->onReadable()) {
+                    again.push_back(source);
+                } else {
+                    source->pending = false;
+                }
+            }
+            pending.swap(again);
+        }
+    }
+
+    // Make run() return; safe to call from any thread or a signal handler
+    void stop() {
+        uint64_t one = 1;
+        ssize_t written = write(_stopFd, &one, sizeof(one));
+        (void)written; // Only fails if the counter is already set
+    }
+
+private:
+    struct Source {
+        int fd = -1;
+        bool ownsFd = false; // Timers and events own their descriptor
+        bool isEvent = false; // An eventfd from addEvent()
+        bool pending = false; // Waiting for another turn of onReadable
+        ReadHandler onReadable;
+        TimerHandler onTimer;
+    };
+
+    int _epollFd;
+    int _stopFd;
+    std::vector<std::unique_ptr<Source>> _sources;
+    std::vector<Source*> _pending; // Readable sources that stopped before draining; run() only
+
+    // Register fd for edge-triggered reads; a null source marks the stop eventfd
+    void watch(int fd, Source* source) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = source;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::runtime_error(std::string("Failed to watch descriptor: ") + std::strerror(errno));
+        }
+    }
+
+    void closeAll() {
+        for (auto& source : _sources) {
+            if (source->ownsFd) {
+                close(source->fd);
+            }
+        }
+        _sources.clear();
+        if (_stopFd >= 0) {
+            close(_stopFd);
+        }
+        if (_epollFd >= 0) {
+            close(_epollFd);
+        }
+    }
+};
+
+#endif // REACTOR_H
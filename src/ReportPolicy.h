@@ -0,0 +1,114 @@
+#ifndef REPORTPOLICY_H
+#define REPORTPOLICY_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include "GPSSensor.h"
+
+// When an eBike sends its position
+struct ReportPolicyOptions {
+    double minDisplacement = 20; // Metres the bike may be from where the gateway places it
+    std::chrono::milliseconds heartbeat{60000}; // Longest time between reports, moving or parked
+    bool deadReckoning = true; // The gateway places a moving bike along its last velocity
+};
+
+// Why a fix was reported, or None if it was held back
+enum class ReportReason : uint8_t {
+    None = 0,
+    First,
+    Moved,
+    Heartbeat,
+    StatusChanged
+};
+
+inline const char* reportReasonToString(ReportReason reason) {
+    switch (reason) {
+        case ReportReason::First: return "first";
+        case ReportReason::Moved: return "moved";
+        case ReportReason::Heartbeat: return "heartbeat";
+        case ReportReason::StatusChanged: return "status";
+        default: return "none";
+    }
+}
+
+// ReportPolicy: Decides which of a bike's GPS fixes are worth sending.
+//
+// The policy keeps the gateway's view of the bike: the last reported fix
+// and, with dead reckoning, the velocity between the last two reports, the
+// same estimate the gateway makes from the fix times in the reports it
+// receives and the map extrapolates from. A fix is
+// only sent when the bike has strayed more than minDisplacement from that
+// view, when its status changes, or when heartbeat has passed since the
+// last report, so a parked bike sends one report per heartbeat and a bike
+// moving steadily along a straight road sends little more.
+//
+// One policy per bike; it is not thread-safe.
+class ReportPolicy {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit ReportPolicy(const ReportPolicyOptions& options = ReportPolicyOptions()) : _options(options) {}
+
+    // Decide whether to report a fix taken at a given time. A fix that is
+    // reported becomes the gateway's view of the bike.
+    ReportReason evaluate(const GPSFix& fix, uint8_t status, Clock::time_point now) {
+        ReportReason reason = ReportReason::None;
+        if (!_hasReport) {
+            reason = ReportReason::First;
+        } else if (status != _status) {
+            reason = ReportReason::StatusChanged;
+        } else if (now - _reportTime >= _options.heartbeat) {
+            reason = ReportReason::Heartbeat;
+        } else if (distance(fix, expected(now)) > _options.minDisplacement) {
+            reason = ReportReason::Moved;
+        }
+        if (reason != ReportReason::None) {
+            record(fix, status, now);
+        }
+        return reason;
+    }
+
+    // Where the gateway places the bike at a given time
+    GPSFix expected(Clock::time_point now) const {
+        if (!_options.deadReckoning) {
+            return _report;
+        }
+        double elapsed = std::chrono::duration<double>(now - _reportTime).count();
+        return GPSFix{_report.lat + _velocityLat * elapsed, _report.lon + _velocityLon * elapsed};
+    }
+
+    // Distance between two fixes in metres; accurate to well under a
+    // percent over the few hundred metres between reports
+    static double distance(const GPSFix& a, const GPSFix& b) {
+        const double metresPerDegree = 6371000.0 * M_PI / 180.0;
+        double north = (b.lat - a.lat) * metresPerDegree;
+        double east = (b.lon - a.lon) * metresPerDegree * std::cos((a.lat + b.lat) * (M_PI / 360.0));
+        return std::sqrt(north * north + east * east);
+    }
+
+private:
+    ReportPolicyOptions _options;
+    bool _hasReport = false;
+    GPSFix _report{0, 0}; // Last reported fix
+    uint8_t _status = 0;
+    Clock::time_point _reportTime;
+    double _velocityLat = 0; // Degrees per second between the last two reports
+    double _velocityLon = 0;
+
+    void record(const GPSFix& fix, uint8_t status, Clock::time_point now) {
+        if (_hasReport) {
+            double elapsed = std::chrono::duration<double>(now - _reportTime).count();
+            if (elapsed > 0) {
+                _velocityLat = (fix.lat - _report.lat) / elapsed;
+                _velocityLon = (fix.lon - _report.lon) / elapsed;
+            }
+        }
+        _hasReport = true;
+        _report = fix;
+        _status = status;
+        _reportTime = now;
+    }
+};
+
+#endif // REPORTPOLICY_H
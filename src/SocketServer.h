@@ -1,22 +1,82 @@
 #ifndef SOCKETSERVER_H
 #define SOCKETSERVER_H
 
-#include <iostream>
 #include <string>
 #include <cstring>
 #include <thread>
 #include <csignal>
 #include <atomic>
+#include <vector>
+#include <memory>
+#include <climits>
+#include <cstdint>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 #include "sim/socket.h"
 #include "sim/in.h"
 #include "MessageHandler.h"
-#include <Poco/JSON/Array.h>
+#include "FleetStore.h"
+#include "IngestWorkers.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "BinaryProtocol.h"
+#include "BoundedQueue.h"
+#include "Pipeline.h"
+#include "Reactor.h"
 
+// SocketServer: Receives eBike reports over UDP through a pipeline of
+// stages, connected by bounded lock-free queues, so a slow stage never
+// stops the sockets from being drained:
+//
+//   receive  recvfrom into a free datagram slot, for every listening port
+//   decode   parse each datagram and queue its position reports
+//   apply    one ingest worker per fleet shard (IngestWorkers)
+//   respond  sendto the reply for each datagram, from the port it came to
+//
+// The receive and respond stages share a Reactor: one thread waits on
+// every port with edge-triggered epoll and drains each non-blocking socket
+// in turn, and sends the queued replies when the decode stage signals an
+// event. The sockets are only ever used from that thread, since sim::socket
+// keeps per-thread state without locking. stop() wakes the reactor at
+// once through its eventfd; the same thread then sends the replies still
+// queued while the decode stage drains.
+//
+// When the decoder falls behind and every slot is in use, the receive
+// stage drops the oldest undecoded datagram (or the new one, with
+// DropNewest); replies that do not fit the respond queue are dropped.
 class SocketServer {
 public:
-    SocketServer(Poco::JSON::Array::Ptr& ebikes, int port = 8081) 
-        : _ebikes(ebikes), _port(port), _running(false), _messageHandler(ebikes) {
+    // Most datagrams decoded before their reports are handed to the workers
+    static const size_t MaxDatagramsPerWakeup = 64;
+    // Most datagrams read from one port before the other ports get a turn
+    static const size_t MaxDatagramsPerTurn = 256;
+    // Receive buffer per datagram, large enough for a full binary batch
+    static const size_t DatagramBufferSize = 8192;
+    static_assert(DatagramBufferSize > BinaryProtocol::MaxBatchSize, "Buffer must hold a full batch");
+
+    SocketServer(FleetStore& fleet, int port = 8081, const PipelineOptions& options = PipelineOptions())
+        : SocketServer(fleet, std::vector<int>{port}, options) {}
+
+    // Listen on several UDP ports, all feeding the same pipeline
+    SocketServer(FleetStore& fleet, const std::vector<int>& ports, const PipelineOptions& options = PipelineOptions())
+        : _fleet(fleet), _ports(ports), _options(options), _running(false),
+          _workers(fleet, options), _messageHandler(fleet, &_workers),
+          _slots(new Datagram[options.datagramSlots]), _discard(new Datagram), _freeSlots(options.datagramSlots),
+          _received(options.datagramSlots), _responses(options.responseCapacity),
+          _decodeMetrics("decode"), _respondMetrics("respond"),
+          _wakeups(Metrics::instance().counter("gateway_socket_wakeups_total",
+              "Times the decode stage woke up to drain datagrams")),
+          _datagrams(Metrics::instance().counter("gateway_datagrams_received_total",
+              "Datagrams received by the socket server")),
+          _bytes(Metrics::instance().counter("gateway_datagram_bytes_received_total",
+              "Bytes of datagrams received by the socket server")),
+          _handlingTime(Metrics::instance().histogram("gateway_message_handling_seconds",
+              "Time to parse and handle one datagram, before the fleet update")),
+          _flushTime(Metrics::instance().histogram("gateway_flush_seconds",
+              "Time to hand one wakeup's position reports to the ingest workers")) {
+        for (size_t i = 0; i < options.datagramSlots; ++i) {
+            _freeSlots.tryPush(static_cast<uint32_t>(i));
+        }
     }
 
     ~SocketServer() {
@@ -25,12 +85,18 @@ public:
 
     void start() {
         if (_running) {
-            std::cout << "Server is already running" << std::endl;
+            LOG_WARNING("Server is already running");
             return;
         }
 
+        if (_sockets.empty()) {
+            openSockets();
+        }
+
         _running = true;
+        _decoding = true;
         _serverThread = std::thread(&SocketServer::serverLoop, this);
+        _decodeThread = std::thread(&SocketServer::decodeLoop, this);
     }
 
     void stop() {
@@ -39,73 +105,269 @@ public:
         }
 
         _running = false;
+        _reactor.stop();
 
+        // Each stage drains its queue before it exits; the server thread
+        // sends the last replies once the decode stage is done
+        _decodeDoorbell.ring();
+        if (_decodeThread.joinable()) {
+            _decodeThread.join();
+        }
         if (_serverThread.joinable()) {
             _serverThread.join();
         }
 
-        if (_serverSocket) {
-            delete _serverSocket;
-            _serverSocket = nullptr;
-        }
+        _workers.stop();
 
-        std::cout << "Socket server stopped" << std::endl;
+        LOG_INFO("Socket server stopped");
     }
 
 private:
-    Poco::JSON::Array::Ptr& _ebikes;
-    int _port;
+    // How often datagrams dropped under overload are reported in the log
+    static constexpr std::chrono::seconds DropReportInterval{10};
+
+    // A received datagram, in one of the preallocated slots
+    struct Datagram {
+        size_t length;
+        size_t socketIndex; // Port it arrived on, as an index into _sockets
+        struct sockaddr_in clientAddr;
+        char data[DatagramBufferSize];
+    };
+
+    // A reply waiting to be sent; texts are static strings
+    struct Response {
+        struct sockaddr_in clientAddr;
+        size_t socketIndex;
+        const char* text;
+    };
+
+    FleetStore& _fleet;
+    std::vector<int> _ports;
+    PipelineOptions _options;
     std::atomic<bool> _running;
+    std::atomic<bool> _decoding{false}; // Until the decode stage exits
     std::thread _serverThread;
-    sim::socket* _serverSocket = nullptr;
-    MessageHandler _messageHandler;
+    std::thread _decodeThread;
+    std::vector<std::unique_ptr<sim::socket>> _sockets; // One per listening port; server thread only
+    Reactor _reactor; // Receive and respond stage event loop
+    int _respondEvent = -1; // Signalled when replies are queued
+    uint64_t _dropsReported = 0; // Reactor thread only
+    IngestWorkers _workers;
+    MessageHandler _messageHandler; // Handles messages on the decode stage, sends on the server thread
+    std::unique_ptr<Datagram[]> _slots;
+    std::unique_ptr<Datagram> _discard; // Receives datagrams while every slot is in use
+    BoundedQueue<uint32_t> _freeSlots; // Slots ready to receive into
+    BoundedQueue<uint32_t> _received; // Slots waiting to be decoded, oldest first
+    BoundedQueue<Response> _responses;
+    Doorbell _decodeDoorbell;
+    Doorbell _respondDoorbell;
+    StageMetrics _decodeMetrics;
+    StageMetrics _respondMetrics;
+    Counter& _wakeups;
+    Counter& _datagrams;
+    Counter& _bytes;
+    Histogram& _handlingTime;
+    Histogram& _flushTime;
+
+    // Bind every port and register it with the reactor; a port that
+    // cannot be bound is logged and skipped
+    void openSockets() {
+        for (int port : _ports) {
+            try {
+                std::unique_ptr<sim::socket> socket(new sim::socket(AF_INET, SOCK_DGRAM, 0));
+
+                // Prepare server address
+                struct sockaddr_in serverAddr;
+                memset(&serverAddr, 0, sizeof(serverAddr));
+                serverAddr.sin_family = AF_INET;
+                serverAddr.sin_port = htons(port);
+                serverAddr.sin_addr.s_addr = INADDR_ANY;
 
+                // Bind the socket to the server address
+                socket->bind(serverAddr);
+
+                size_t index = _sockets.size();
+                _reactor.addReadable(socket->fd(), [this, index] { return receive(index); });
+                _sockets.push_back(std::move(socket));
+                LOG_INFO("Socket server running on port " << port << " and waiting for messages...");
+            } catch (const std::exception& e) {
+                LOG_ERROR("Socket server error on port " << port << ": " << e.what());
+            }
+        }
+        _respondEvent = _reactor.addEvent([this] { return sendResponses(); });
+        _reactor.addTimer(DropReportInterval, [this] { reportDrops(); });
+    }
+
+    // Receive and respond stages
     void serverLoop() {
         try {
-            // Create the server socket
-            _serverSocket = new sim::socket(AF_INET, SOCK_DGRAM, 0);
-
-            // Prepare server address
-            struct sockaddr_in serverAddr;
-            memset(&serverAddr, 0, sizeof(serverAddr));
-            serverAddr.sin_family = AF_INET;
-            serverAddr.sin_port = htons(_port);
-            serverAddr.sin_addr.s_addr = INADDR_ANY;
-
-            // Bind the socket to the server address
-            _serverSocket->bind(serverAddr);
-
-            std::cout << "Socket server running on port " << _port << " and waiting for messages..." << std::endl;
-
-            // Buffer for receiving messages
-            char buffer[1024];
-            struct sockaddr_in clientAddr;
-
-            while (_running) {
-                // Reset buffer
-                memset(buffer, 0, sizeof(buffer));
-
-                // Receive message
-                ssize_t bytesReceived = _serverSocket->recvfrom(buffer, sizeof(buffer) - 1, 0, clientAddr);
-                
-                if (bytesReceived > 0) {
-                    buffer[bytesReceived] = '\0'; // Null-terminate the message
-                    
-                    // Get client IP and port
-                    char clientIp[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, sizeof(clientIp));
-                    uint16_t clientPort = ntohs(clientAddr.sin_port);
-                    
-                    // Handle the message
-                    const char* response = _messageHandler.handleMessage(buffer, clientIp, clientPort);
-                    
-                    // Send the response back to the client
-                    _messageHandler.sendResponse(_serverSocket, response, clientAddr);
+            _reactor.run();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Socket server error: " << e.what());
+        }
+
+        // Send the replies the decode stage queues while it drains
+        while (true) {
+            bool decoding = _decoding;
+            while (sendResponses()) {
+            }
+            // Nothing more can be queued once the decode stage has exited
+            if (!decoding) {
+                return;
+            }
+            _respondDoorbell.wait([&] { return !_responses.empty() || !_decoding; },
+                std::chrono::milliseconds(100));
+        }
+    }
+
+    // Read what is queued on one port; returns true if there may be more
+    bool receive(size_t socketIndex) {
+        sim::socket& socket = *_sockets[socketIndex];
+        bool more = true;
+        size_t queued = 0;
+
+        for (size_t n = 0; n < MaxDatagramsPerTurn; ++n) {
+            uint32_t slot;
+            bool haveSlot = _freeSlots.tryPop(slot);
+            Datagram* datagram = haveSlot ? &_slots[slot] : _discard.get();
+
+            // received messages are null-terminated so they never need clearing
+            ssize_t bytesReceived;
+            try {
+                bytesReceived = socket.recvfrom(datagram->data, DatagramBufferSize - 1, MSG_DONTWAIT,
+                    datagram->clientAddr);
+            } catch (const std::exception&) {
+                bytesReceived = -1; // Nothing more queued
+            }
+            if (bytesReceived < 0) {
+                if (haveSlot) {
+                    _freeSlots.tryPush(slot);
                 }
+                more = false;
+                break;
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Socket server error: " << e.what() << std::endl;
+
+            if (!haveSlot) {
+                if (_options.receivePolicy == OverloadPolicy::DropNewest || !_received.tryPop(slot)) {
+                    _decodeMetrics.dropped.increment();
+                    continue;
+                }
+                // Overloaded: this datagram takes the slot of the oldest undecoded one
+                _decodeMetrics.dropped.increment();
+                _decodeMetrics.depth.add(-1);
+                Datagram& reused = _slots[slot];
+                std::memcpy(reused.data, datagram->data, static_cast<size_t>(bytesReceived));
+                reused.clientAddr = datagram->clientAddr;
+                datagram = &reused;
+            }
+            if (bytesReceived == 0) {
+                _freeSlots.tryPush(slot);
+                continue;
+            }
+
+            datagram->data[bytesReceived] = '\0'; // Null-terminate the message
+            datagram->length = static_cast<size_t>(bytesReceived);
+            datagram->socketIndex = socketIndex;
+            _datagrams.increment();
+            _bytes.increment(static_cast<uint64_t>(bytesReceived));
+
+            // Every slot fits in the queue, so this never fails
+            _decodeMetrics.depth.add(1);
+            _received.tryPush(slot);
+            queued++;
+        }
+
+        if (queued) {
+            _decodeDoorbell.ring();
+        }
+        return more;
+    }
+
+    // Log how many datagrams and replies were dropped since the last report
+    void reportDrops() {
+        uint64_t dropped = _decodeMetrics.dropped.value() + _respondMetrics.dropped.value();
+        if (dropped > _dropsReported) {
+            LOG_WARNING("Socket server overloaded: dropped " << dropped - _dropsReported <<
+                " datagrams or replies in the last " << DropReportInterval.count() << " s");
+        }
+        _dropsReported = dropped;
+    }
+
+    // Decode stage: parse datagrams, hand their reports to the apply stage
+    // and queue the replies
+    void decodeLoop() {
+        std::vector<uint32_t> batch;
+        std::vector<const char*> responses(MaxDatagramsPerWakeup);
+        batch.reserve(MaxDatagramsPerWakeup);
+
+        while (true) {
+            uint32_t slot;
+            while (batch.size() < MaxDatagramsPerWakeup && _received.tryPop(slot)) {
+                batch.push_back(slot);
+            }
+
+            if (batch.empty()) {
+                if (!_running) {
+                    _decoding = false;
+                    _respondDoorbell.ring();
+                    return;
+                }
+                _decodeDoorbell.wait([&] { return !_received.empty() || !_running; },
+                    std::chrono::milliseconds(100));
+                continue;
+            }
+            _wakeups.increment();
+            _decodeMetrics.depth.add(-static_cast<int64_t>(batch.size()));
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                Datagram& datagram = _slots[batch[i]];
+
+                // Get client IP and port
+                char clientIp[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &datagram.clientAddr.sin_addr, clientIp, sizeof(clientIp));
+                uint16_t clientPort = ntohs(datagram.clientAddr.sin_port);
+
+                // Handle the message
+                Histogram::Timer timer(_handlingTime);
+                responses[i] = _messageHandler.handleMessage(datagram.data, datagram.length, clientIp, clientPort);
+            }
+
+            // Hand every position report of this wakeup to the workers
+            {
+                Histogram::Timer timer(_flushTime);
+                _messageHandler.flush();
+            }
+
+            // Queue the replies and give the slots back to the receive stage
+            for (size_t i = 0; i < batch.size(); ++i) {
+                Datagram& datagram = _slots[batch[i]];
+                _respondMetrics.depth.add(1);
+                if (!_responses.tryPush(Response{datagram.clientAddr, datagram.socketIndex, responses[i]})) {
+                    _respondMetrics.depth.add(-1);
+                    _respondMetrics.dropped.increment();
+                }
+                _freeSlots.tryPush(batch[i]);
+            }
+            _decodeMetrics.processed.increment(batch.size());
+            Reactor::notify(_respondEvent);
+            _respondDoorbell.ring();
+            batch.clear();
+        }
+    }
+
+    // Respond stage: send queued replies back to the clients, on the
+    // server thread; returns true if there may be more
+    bool sendResponses() {
+        for (size_t n = 0; n < MaxDatagramsPerTurn; ++n) {
+            Response response;
+            if (!_responses.tryPop(response)) {
+                return false;
+            }
+            _respondMetrics.depth.add(-1);
+            _messageHandler.sendResponse(_sockets[response.socketIndex].get(), response.text, response.clientAddr);
+            _respondMetrics.processed.increment();
         }
+        return true;
     }
 };
 
@@ -0,0 +1,77 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+// Keep a value alive so the compiler cannot optimise away the work producing it
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Benchmark: Runs microbenchmarks and prints one JSON object per line,
+// so results can be diffed or loaded between releases:
+//
+//   {"benchmark":"fleet.toGeoJSON/1000","iterations":2048,"ns_per_op":...,"min_ns_per_op":...,"ops_per_sec":...}
+//
+// Each benchmark is calibrated to run for at least MinSampleTime per
+// sample; the median of Samples samples is reported, along with the
+// fastest.
+class Benchmark {
+public:
+    static constexpr int Samples = 5;
+    static constexpr std::chrono::milliseconds MinSampleTime{100};
+
+    explicit Benchmark(const std::string& filter = "") : _filter(filter) {}
+
+    // Time body(iterations), which must perform that many operations
+    template <typename Body>
+    void run(const std::string& name, Body body) {
+        if (!_filter.empty() && name.find(_filter) == std::string::npos) {
+            return;
+        }
+
+        // Warm up, then grow the iteration count until a sample is long enough
+        uint64_t iterations = 1;
+        body(iterations);
+        while (true) {
+            double seconds = time(body, iterations);
+            if (seconds >= std::chrono::duration<double>(MinSampleTime).count()) {
+                break;
+            }
+            uint64_t scale = seconds > 0 ? static_cast<uint64_t>(
+                std::chrono::duration<double>(MinSampleTime).count() / seconds * 1.2) : 16;
+            iterations *= std::max<uint64_t>(2, std::min<uint64_t>(scale, 16));
+        }
+
+        std::vector<double> nsPerOp;
+        for (int i = 0; i < Samples; ++i) {
+            nsPerOp.push_back(time(body, iterations) * 1e9 / iterations);
+        }
+        std::sort(nsPerOp.begin(), nsPerOp.end());
+        double median = nsPerOp[Samples / 2];
+
+        std::printf("{\"benchmark\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,"
+                    "\"ops_per_sec\":%.0f}\n",
+                    name.c_str(), static_cast<unsigned long long>(iterations), median, nsPerOp.front(),
+                    median > 0 ? 1e9 / median : 0.0);
+        std::fflush(stdout);
+    }
+
+private:
+    std::string _filter;
+
+    template <typename Body>
+    static double time(Body& body, uint64_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,392 @@
+#include "Benchmark.h"
+#include "FleetStore.h"
+#include "MessageHandler.h"
+#include "BinaryProtocol.h"
+#include "GPSSensor.h"
+#include "GeofenceEngine.h"
+#include "Numbers.h"
+#include "Logger.h"
+#include "hal/CSVHALManager.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <charconv>
+#include <unistd.h>
+
+// Microbenchmarks for the gateway hot paths. Run with `make bench`; pass a
+// substring to run only the matching benchmarks.
+
+namespace {
+
+const int MessageIds = 1000;
+const size_t FlushEvery = 64; // Datagrams handled per socket server wakeup
+
+// Fill a fleet with bikes scattered around Bristol
+void populate(FleetStore& fleet, int bikes) {
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> offset(-0.05, 0.05);
+    for (int id = 0; id < bikes; ++id) {
+        fleet.updatePosition(id, 51.4545 + offset(random), -2.5879 + offset(random),
+            id % 3 == 0 ? EBikeStatus::Locked : EBikeStatus::Unlocked);
+    }
+}
+
+// Write a CSV recording of GPS fixes to a temporary file
+std::string writeRecording(size_t rows) {
+    char path[] = "/tmp/gatewayBench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::perror("mkstemp");
+        std::exit(1);
+    }
+    FILE* file = fdopen(fd, "w");
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> offset(-0.05, 0.05);
+    for (size_t i = 0; i < rows; ++i) {
+        std::fprintf(file, "%.6f,%.6f\n", 51.4545 + offset(random), -2.5879 + offset(random));
+    }
+    std::fclose(file);
+    return path;
+}
+
+void benchMessageHandler(Benchmark& bench) {
+    FleetStore fleet;
+    MessageHandler handler(fleet);
+
+    std::vector<std::string> json;
+    std::vector<std::vector<uint8_t>> binary;
+    for (int id = 0; id < MessageIds; ++id) {
+        char message[256];
+        std::snprintf(message, sizeof(message),
+            "{\"type\":\"position\",\"id\":%d,\"lat\":%.6f,\"lon\":%.6f,\"status\":\"unlocked\"}",
+            id, 51.4545 + id * 1e-5, -2.5879 - id * 1e-5);
+        json.push_back(message);
+
+        std::vector<uint8_t> encoded(BinaryProtocol::PositionSize);
+        BinaryProtocol::PositionReport report{id, 51.4545 + id * 1e-5, -2.5879 - id * 1e-5, 0};
+        BinaryProtocol::encodePosition(encoded.data(), report);
+        binary.push_back(encoded);
+    }
+
+    bench.run("messageHandler.handleMessage/json", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const std::string& message = json[i % MessageIds];
+            doNotOptimize(handler.handleMessage(message.c_str(), message.size(), "127.0.0.1", 5000));
+            if (i % FlushEvery == FlushEvery - 1) {
+                handler.flush();
+            }
+        }
+        handler.flush();
+    });
+
+    bench.run("messageHandler.handleMessage/binary", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const std::vector<uint8_t>& message = binary[i % MessageIds];
+            doNotOptimize(handler.handleMessage(reinterpret_cast<const char*>(message.data()), message.size(),
+                "127.0.0.1", 5000));
+            if (i % FlushEvery == FlushEvery - 1) {
+                handler.flush();
+            }
+        }
+        handler.flush();
+    });
+}
+
+void benchSerialization(Benchmark& bench) {
+    for (int bikes : {1000, 10000, 100000}) {
+        FleetStore fleet;
+        populate(fleet, bikes);
+
+        bench.run("fleet.toGeoJSON/" + std::to_string(bikes), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                std::string body = fleet.toGeoJSON();
+                doNotOptimize(body.data());
+            }
+        });
+
+        // A map viewport covering about a tenth of the fleet
+        FleetFilter filter;
+        filter.hasBox = true;
+        filter.minLat = 51.4545 - 0.016;
+        filter.maxLat = 51.4545 + 0.016;
+        filter.minLon = -2.5879 - 0.016;
+        filter.maxLon = -2.5879 + 0.016;
+        bench.run("fleet.toGeoJSON.bbox/" + std::to_string(bikes), [&](uint64_t iterations) {
+            uint64_t version;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                std::string body = fleet.toGeoJSON(filter, version);
+                doNotOptimize(body.data());
+            }
+        });
+
+        // A client polling after 100 bikes moved; the cost should follow
+        // the changes, not the fleet size
+        uint64_t since = fleet.version();
+        for (int id = 0; id < 100; ++id) {
+            fleet.updatePosition(id * (bikes / 100), 51.4545, -2.5879, EBikeStatus::Unlocked);
+        }
+        bench.run("fleet.toGeoJSONDelta/" + std::to_string(bikes), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                std::string body = fleet.toGeoJSONDelta(since);
+                doNotOptimize(body.data());
+            }
+        });
+    }
+}
+
+void benchHAL(Benchmark& bench) {
+    const size_t rows = 100000;
+    std::string path = writeRecording(rows);
+
+    for (CSVLoadMode mode : {CSVLoadMode::Mapped, CSVLoadMode::Streaming}) {
+        const char* modeName = mode == CSVLoadMode::Mapped ? "mapped" : "streaming";
+        CSVHALManager halManager(1);
+        halManager.attachDevice(0, std::make_shared<GPSSensor>());
+
+        // One operation loads the whole recording
+        bench.run(std::string("hal.initialise.") + modeName + "/" + std::to_string(rows), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                halManager.initialise(path, mode);
+                if (mode == CSVLoadMode::Streaming) {
+                    // Streaming loads as it reads
+                    try {
+                        while (true) {
+                            doNotOptimize(halManager.readAs<GPSFix>(0));
+                        }
+                    } catch (const std::out_of_range&) {
+                    }
+                }
+            }
+        });
+
+        halManager.initialise(path, mode);
+        auto readRows = [&](uint64_t iterations, auto readOne) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                try {
+                    readOne();
+                } catch (const std::out_of_range&) {
+                    halManager.rewind(0);
+                }
+            }
+        };
+
+        bench.run(std::string("hal.read.") + modeName, [&](uint64_t iterations) {
+            readRows(iterations, [&] { doNotOptimize(halManager.read(0).size()); });
+        });
+        bench.run(std::string("hal.readAs.") + modeName, [&](uint64_t iterations) {
+            readRows(iterations, [&] { doNotOptimize(halManager.readAs<GPSFix>(0)); });
+        });
+    }
+
+    std::remove(path.c_str());
+}
+
+const double GeofenceMinLat = 51.0;
+const double GeofenceMinLon = -3.0;
+
+// Side in degrees of a region holding this many no-parking zones at city density
+double geofenceSpan(int zones) {
+    return 0.01 * std::sqrt(static_cast<double>(zones));
+}
+
+// Coordinates of the bundled tracks, scaled up to many bikes by shifting
+// each copy a little, as text cells the way the CSVs hold them
+std::vector<std::string> trackCells(size_t count) {
+    std::vector<double> track;
+    for (int file = 1; file <= 4; ++file) {
+        std::ifstream in("data/sim-eBike-" + std::to_string(file) + ".csv");
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t comma = line.find(',');
+            double lat, lon;
+            if (comma != std::string::npos && Numbers::parseAll(line.data(), line.data() + comma, lat) &&
+                Numbers::parseAll(line.data() + comma + 1, line.data() + line.size(), lon)) {
+                track.push_back(lat);
+                track.push_back(lon);
+            }
+        }
+    }
+    if (track.empty()) {
+        track = {51.4545, -2.5879};
+    }
+
+    std::vector<std::string> cells;
+    for (size_t i = 0; i < count; ++i) {
+        char cell[32];
+        std::snprintf(cell, sizeof(cell), "%.6f", track[i % track.size()] + (i / track.size()) * 1e-6);
+        cells.push_back(cell);
+    }
+    return cells;
+}
+
+void benchNumbers(Benchmark& bench) {
+    std::vector<std::string> cells = trackCells(100000);
+    std::vector<double> values;
+    for (const std::string& cell : cells) {
+        double value;
+        Numbers::parseAll(cell, value);
+        values.push_back(value);
+    }
+
+    bench.run("numbers.parse", [&](uint64_t iterations) {
+        double sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const std::string& cell = cells[i % cells.size()];
+            double value;
+            Numbers::parse(cell.data(), cell.data() + cell.size(), value);
+            sum += value;
+        }
+        doNotOptimize(sum);
+    });
+    bench.run("numbers.parse.from_chars", [&](uint64_t iterations) {
+        double sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const std::string& cell = cells[i % cells.size()];
+            double value;
+            std::from_chars(cell.data(), cell.data() + cell.size(), value);
+            sum += value;
+        }
+        doNotOptimize(sum);
+    });
+
+    bench.run("numbers.format", [&](uint64_t iterations) {
+        char buffer[Numbers::MaxLength];
+        size_t length = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            length += static_cast<size_t>(Numbers::format(buffer, values[i % values.size()]) - buffer);
+        }
+        doNotOptimize(length);
+    });
+    bench.run("numbers.format.to_chars", [&](uint64_t iterations) {
+        char buffer[Numbers::MaxLength];
+        size_t length = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            length += static_cast<size_t>(
+                std::to_chars(buffer, buffer + sizeof(buffer), values[i % values.size()]).ptr - buffer);
+        }
+        doNotOptimize(length);
+    });
+}
+
+// A detailed service area around the region plus small zones scattered across it
+GeofenceIndex makeGeofences(int zones) {
+    const double minLat = GeofenceMinLat, minLon = GeofenceMinLon, span = geofenceSpan(zones);
+    GeofenceIndex index;
+
+    Geofence area;
+    area.name = "service area";
+    area.kind = "service-area";
+    std::vector<GeoPoint> outline;
+    for (int i = 0; i < 1000; ++i) {
+        double angle = 2 * M_PI * i / 1000;
+        double radius = span * (0.45 + 0.03 * std::sin(angle * 17));
+        outline.push_back(GeoPoint{minLon + span / 2 + radius * std::cos(angle),
+            minLat + span / 2 + radius * std::sin(angle)});
+    }
+    area.rings.push_back(outline);
+    index.add(area);
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<double> position(0, span);
+    for (int i = 0; i < zones; ++i) {
+        Geofence zone;
+        zone.id = i + 1;
+        zone.kind = "no-parking";
+        double lat = minLat + position(random), lon = minLon + position(random);
+        zone.rings.push_back({{lon, lat}, {lon + 0.004, lat}, {lon + 0.005, lat + 0.003}, {lon, lat + 0.004}});
+        index.add(zone);
+    }
+    return index;
+}
+
+// Bikes scattered across the region of makeGeofences(zones)
+std::vector<GeoPoint> makeGeofencePoints(int zones) {
+    std::mt19937 random(3);
+    std::uniform_real_distribution<double> offset(0, geofenceSpan(zones));
+    std::vector<GeoPoint> points;
+    for (int i = 0; i < 4096; ++i) {
+        points.push_back(GeoPoint{GeofenceMinLon + offset(random), GeofenceMinLat + offset(random)});
+    }
+    return points;
+}
+
+void benchGeofences(Benchmark& bench) {
+    // The fleet covers more ground as the number of fences grows, so the
+    // cost per update should stay flat
+    for (int zones : {100, 10000}) {
+        GeofenceIndex index = makeGeofences(zones);
+        std::vector<GeoPoint> points = makeGeofencePoints(zones);
+
+        bench.run("geofences.containing/" + std::to_string(zones), [&](uint64_t iterations) {
+            size_t found = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                const GeoPoint& point = points[i % points.size()];
+                index.containing(point.lat, point.lon, [&](uint32_t) { found++; });
+            }
+            doNotOptimize(found);
+        });
+
+        FleetStore fleet;
+        GeofenceEngine engine(fleet, index);
+        bench.run("fleet.updatePosition.geofences/" + std::to_string(zones), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                const GeoPoint& point = points[i % points.size()];
+                fleet.updatePosition(static_cast<int>(i % MessageIds), point.lat, point.lon, EBikeStatus::Unlocked);
+            }
+        });
+    }
+
+    // What the index saves: every fence tested in turn
+    GeofenceIndex index = makeGeofences(100);
+    std::vector<GeoPoint> points = makeGeofencePoints(100);
+    bench.run("geofences.bruteForce/100", [&](uint64_t iterations) {
+        size_t found = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            for (size_t f = 0; f < index.size(); ++f) {
+                found += GeofenceIndex::contains(index.fence(f), points[i % points.size()]);
+            }
+        }
+        doNotOptimize(found);
+    });
+}
+
+void benchGPSSensor(Benchmark& bench) {
+    GPSSensor sensor;
+    std::string text = "51.455992;-2.509034";
+    std::vector<uint8_t> reading(text.begin(), text.end());
+    GPSFix fix{51.455992, -2.509034};
+
+    bench.run("gpsSensor.format/bytes", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            doNotOptimize(sensor.format(reading).size());
+        }
+    });
+    bench.run("gpsSensor.format/fix", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            doNotOptimize(sensor.format(fix).size());
+        }
+    });
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    // Keep log lines out of the results
+    Logger::instance().setLevel(LogLevel::Off);
+
+    Benchmark bench(argc > 1 ? argv[1] : "");
+    benchNumbers(bench);
+    benchMessageHandler(bench);
+    benchSerialization(bench);
+    benchHAL(bench);
+    benchGeofences(bench);
+    benchGPSSensor(bench);
+
+    Logger::instance().shutdown();
+    return 0;
+}
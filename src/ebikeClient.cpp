@@ -5,8 +5,16 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <cstring>
+#include <thread>
+#include <arpa/inet.h>
 #include "hal/CSVHALManager.h"
 #include "GPSSensor.h"
+#include "BinaryProtocol.h"
+#include "LoadGenerator.h"
+#include "ReportPolicy.h"
+#include "Numbers.h"
+#include "sim/socket.h"
 
 std::string getCurrentTimestamp() {
     auto now = std::chrono::system_clock::now();
@@ -22,15 +30,178 @@ std::string getCurrentTimestamp() {
     return oss.str();
 }
 
+// Build a position report, stamped with when the fix was taken, in the
+// requested wire format
+size_t encodePositionReport(char* buffer, size_t size, bool binary, int id, double lat, double lon,
+                            int64_t sampleMs) {
+    if (binary) {
+        BinaryProtocol::PositionReport report{id, lat, lon, 0, sampleMs};
+        return BinaryProtocol::encodePosition(reinterpret_cast<uint8_t*>(buffer), report);
+    }
+
+    return encodePositionJSON(buffer, size, id, lat, lon, sampleMs);
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <csv_file_path> <port_number>"
+              << " [--gateway <ip>:<port>] [--id <ebike_id>] [--format json|binary] [--period-ms <ms>]"
+              << " [--report all|adaptive] [--min-move <metres>] [--heartbeat <s>] [--dead-reckoning on|off]"
+              << std::endl;
+    std::cerr << "       " << program << " --load --gateway <ip>:<port> [--bikes <n>] [--rate <samples/s>]"
+              << " [--duration <s>] [--jitter <degrees>] [--id-offset <id>] [--tracks <glob>]"
+              << " [--format json|binary] [--parked <fraction>] [--report all|adaptive] [--min-move <metres>]"
+              << " [--heartbeat <s>] [--dead-reckoning on|off]" << std::endl;
+}
+
+// Parse one of the report policy options; returns false if it is not one
+bool parseReportOption(const std::string& option, const std::string& value, bool& adaptive,
+                       ReportPolicyOptions& policy) {
+    if (option == "--report" && (value == "all" || value == "adaptive")) {
+        adaptive = value == "adaptive";
+    } else if (option == "--min-move") {
+        policy.minDisplacement = std::stod(value);
+    } else if (option == "--heartbeat") {
+        policy.heartbeat = std::chrono::milliseconds(static_cast<int64_t>(std::stod(value) * 1000));
+    } else if (option == "--dead-reckoning" && (value == "on" || value == "off")) {
+        policy.deadReckoning = value == "on";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parse "<ip>:<port>"; returns false if it is not a valid address
+bool parseGatewayAddress(const std::string& address, struct sockaddr_in& addr) {
+    size_t colonPos = address.find(':');
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    int port;
+    if (colonPos == std::string::npos ||
+        inet_pton(AF_INET, address.substr(0, colonPos).c_str(), &addr.sin_addr) != 1 ||
+        !Numbers::parseAll(address.substr(colonPos + 1), port) || port <= 0 || port > 65535) {
+        return false;
+    }
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return true;
+}
+
+// Load generator mode: replay the tracks as many virtual eBikes
+int runLoadGenerator(int argc, char* argv[]) {
+    LoadOptions options;
+    std::string gatewayAddress;
+    try {
+        for (int i = 2; i < argc; ++i) {
+            std::string option = argv[i];
+            if (i + 1 >= argc) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (option == "--gateway") {
+                gatewayAddress = value;
+            } else if (option == "--bikes") {
+                options.bikes = std::stoi(value);
+            } else if (option == "--rate") {
+                options.rate = std::stod(value);
+            } else if (option == "--duration") {
+                options.duration = std::stod(value);
+            } else if (option == "--jitter") {
+                options.jitter = std::stod(value);
+            } else if (option == "--id-offset") {
+                options.idOffset = std::stoi(value);
+            } else if (option == "--tracks") {
+                options.tracks = value;
+            } else if (option == "--format" && (value == "json" || value == "binary")) {
+                options.binary = value == "binary";
+            } else if (option == "--parked") {
+                options.parked = std::stod(value);
+            } else if (!parseReportOption(option, value, options.adaptive, options.policy)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::logic_error&) {
+        // std::stoi and std::stod reject text that is not a number, or out of range
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in gatewayAddr;
+    if (!parseGatewayAddress(gatewayAddress, gatewayAddr)) {
+        std::cerr << "Invalid gateway address: " << gatewayAddress << std::endl;
+        return 1;
+    }
+    if (options.bikes <= 0 || options.rate <= 0 || options.duration <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        LoadGenerator generator(options, gatewayAddr);
+        return generator.run() ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--load") {
+        return runLoadGenerator(argc, argv);
+    }
+
     // Check command line arguments
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <csv_file_path> <port_number>" << std::endl;
+    if (argc < 3) {
+        printUsage(argv[0]);
         return 1;
     }
 
     std::string csvFilePath = argv[1];
-    int portNumber = std::stoi(argv[2]);
+    int portNumber;
+
+    // Optional: send each reading to the gateway as a position report
+    std::string gatewayAddress;
+    int ebikeId = 1;
+    bool binaryFormat = false;
+    int samplePeriod = 0;
+    bool adaptive = false;
+    ReportPolicyOptions policyOptions;
+    try {
+        portNumber = std::stoi(argv[2]);
+        for (int i = 3; i < argc; ++i) {
+            std::string option = argv[i];
+            if (i + 1 >= argc) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (option == "--gateway") {
+                gatewayAddress = value;
+            } else if (option == "--id") {
+                ebikeId = std::stoi(value);
+            } else if (option == "--format" && (value == "json" || value == "binary")) {
+                binaryFormat = value == "binary";
+            } else if (option == "--period-ms") {
+                samplePeriod = std::stoi(value);
+            } else if (!parseReportOption(option, value, adaptive, policyOptions)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::logic_error&) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<sim::socket> gatewaySocket;
+    struct sockaddr_in gatewayAddr;
+    if (!gatewayAddress.empty()) {
+        if (!parseGatewayAddress(gatewayAddress, gatewayAddr)) {
+            std::cerr << "Invalid gateway address: " << gatewayAddress << std::endl;
+            return 1;
+        }
+        gatewaySocket.reset(new sim::socket(AF_INET, SOCK_DGRAM, 0));
+    }
 
     // Create HAL Manager
     CSVHALManager halManager(1); // Initialize with 1 port
@@ -45,35 +216,46 @@ int main(int argc, char* argv[]) {
         // Initialize the CSV file
         halManager.initialise(csvFilePath);
 
+        // Readings are taken every samplePeriod; with no period they are
+        // sent as fast as they are read and the policy counts them a second apart
+        ReportPolicy policy(policyOptions);
+        const ReportPolicy::Clock::time_point start = ReportPolicy::Clock::now();
+        const int64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        const std::chrono::milliseconds sampleInterval(samplePeriod > 0 ? samplePeriod : 1000);
+
         // Read and process GPS data
         int readCount = 0;
+        int sentCount = 0;
         while (true) {
             try {
-                // Read data from the sensor
-                std::vector<uint8_t> reading = halManager.read(portNumber);
-                
-                // Convert byte vector to string for GPS reading
-                std::string readingStr;
-                for (uint8_t byte : reading) {
-                    readingStr += static_cast<char>(byte);
-                }
+                // Read the GPS fix straight from the sensor's columns
+                GPSFix fix = halManager.readAs<GPSFix>(portNumber);
+
+                std::cout << getCurrentTimestamp() << " | GPS: " << std::setprecision(9)
+                          << fix.lat << ", " << fix.lon << std::endl;
 
-                // Extract timestamp and coordinates
-                size_t delimiterPos = readingStr.find(';');
-                if (delimiterPos != std::string::npos) {
-                    std::string timestamp = getCurrentTimestamp();
-                    std::string coordinates = readingStr.substr(0, delimiterPos) + ", " + readingStr.substr(delimiterPos + 1);
-                    
-                    std::cout << timestamp << " | GPS: " << coordinates << std::endl;
-                } else {
-                    std::cerr << "Invalid GPS data format in reading " << readCount << std::endl;
+                ReportPolicy::Clock::time_point sampleTime = start + readCount * sampleInterval;
+                bool send = !adaptive || policy.evaluate(fix, 0, sampleTime) != ReportReason::None;
+                if (gatewaySocket && send) {
+                    char message[256];
+                    int64_t sampleMs = startMs + std::chrono::duration_cast<std::chrono::milliseconds>(
+                        sampleTime - start).count();
+                    size_t length = encodePositionReport(message, sizeof(message), binaryFormat, ebikeId,
+                        fix.lat, fix.lon, sampleMs);
+                    gatewaySocket->sendto(message, length, 0, gatewayAddr);
                 }
-                
+                sentCount += send;
+
                 readCount++;
+                if (samplePeriod > 0) {
+                    std::this_thread::sleep_until(start + readCount * sampleInterval);
+                }
             }
             catch (const std::out_of_range& e) {
                 // No more data available
-                std::cout << "Reached end of data after " << readCount << " readings." << std::endl;
+                std::cout << "Reached end of data after " << readCount << " readings, " << sentCount
+                          << " reported." << std::endl;
                 break;
             }
         }
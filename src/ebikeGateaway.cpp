@@ -1,134 +1,234 @@
 #include "web/WebServer.h"
 #include "hal/CSVHALManager.h"
+#include "hal/SensorScheduler.h"
 #include "GPSSensor.h"
-#include <iostream>
+#include "FleetStore.h"
+#include "SocketServer.h"
+#include "FleetJournal.h"
+#include "FleetHistory.h"
+#include "GeofenceEngine.h"
+#include "Logger.h"
+#include "Numbers.h"
 #include <memory>
+#include <vector>
 #include <chrono>
 #include <thread>
-#include <mutex>
-#include <Poco/JSON/Object.h>
-#include <Poco/JSON/Parser.h>
-#include <Poco/Dynamic/Var.h>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include <glob.h>
 
-std::mutex ebikesMutex;
-
-void updateEbikeData(Poco::JSON::Array::Ptr ebikes, CSVHALManager& halManager, std::shared_ptr<GPSSensor> gpsSensor) {
+// Parse a comma-separated list of ports, e.g. "8081,8082"; returns false if
+// any of it is not a port number
+static bool parsePorts(const std::string& text, std::vector<int>& ports) {
+    std::vector<int> parsed;
+    const char* first = text.data();
+    const char* last = text.data() + text.size();
     while (true) {
-        try {
-            // Read GPS data from the HAL manager
-            std::vector<uint8_t> gpsData = halManager.read(0);
-            std::string formattedData = gpsSensor->format(gpsData);
-            
-            // Parse GPS data
-            std::string dataStr(gpsData.begin(), gpsData.end());
-            std::string::size_type pos = dataStr.find(';');
-            if (pos != std::string::npos) {
-                std::string lat = dataStr.substr(0, pos);
-                std::string lon = dataStr.substr(pos + 1);
-                
-                // Current timestamp for the reading
-                auto now = std::chrono::system_clock::now();
-                auto now_time_t = std::chrono::system_clock::to_time_t(now);
-                std::tm* now_tm = std::localtime(&now_time_t);
-                char timeBuffer[26];
-                strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", now_tm);
-                
-                // Create the GeoJSON Feature for the eBike
-                Poco::JSON::Object::Ptr feature = new Poco::JSON::Object;
-                Poco::JSON::Object::Ptr geometry = new Poco::JSON::Object;
-                Poco::JSON::Array::Ptr coordinates = new Poco::JSON::Array;
-                Poco::JSON::Object::Ptr properties = new Poco::JSON::Object;
-                
-                // Set the geometry (Point with coordinates)
-                geometry->set("type", "Point");
-                coordinates->add(std::stod(lon));
-                coordinates->add(std::stod(lat));
-                geometry->set("coordinates", coordinates);
-                
-                // Set the properties
-                properties->set("id", 1);
-                properties->set("status", "unlocked");
-                properties->set("timestamp", std::string(timeBuffer));
-                
-                // Assemble the feature
-                feature->set("type", "Feature");
-                feature->set("geometry", geometry);
-                feature->set("properties", properties);
-                
-                // Lock the shared ebikes array while updating
-                {
-                    std::lock_guard<std::mutex> lock(ebikesMutex);
-                    
-                    // Check if we have an existing ebike to update
-                    bool updated = false;
-                    for (int i = 0; i < ebikes->size(); i++) {
-                        Poco::JSON::Object::Ptr obj = ebikes->getObject(i);
-                        Poco::JSON::Object::Ptr props = obj->getObject("properties");
-                        
-                        if (props->getValue<int>("id") == 1) {
-                            // Update existing ebike
-                            ebikes->set(i, feature);
-                            updated = true;
-                            break;
-                        }
-                    }
-                    
-                    // If no existing ebike was found, add a new one
-                    if (!updated) {
-                        ebikes->add(feature);
-                    }
-                }
-                
-                std::cout << formattedData << std::endl;
-            }
-        } catch (const std::exception& ex) {
-            std::cerr << "Error updating eBike data: " << ex.what() << std::endl;
+        int port;
+        const char* end = Numbers::parse(first, last, port);
+        if (!end || port <= 0 || port > 65535) {
+            return false;
         }
-        
-        // Sleep for a short period before reading the next data point
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        parsed.push_back(port);
+        if (end == last) {
+            break;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        first = end + 1;
     }
+    ports.swap(parsed);
+    return true;
 }
 
-int main() {
-    // Create a reference to a Poco JSON array to store the ebike objects
-    Poco::JSON::Array::Ptr ebikes = new Poco::JSON::Array();
+// Simulated eBikes: one GPS sensor port per bike, replaying the recorded
+// tracks (bike i replays track i modulo the number of tracks)
+struct SimulatedFleet {
+    std::vector<std::unique_ptr<CSVHALManager>> tracks; // One HAL manager per track file
+
+    SimulatedFleet(const std::string& pattern, int bikes) {
+        std::vector<std::string> files;
+        glob_t matches;
+        if (glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                files.push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+        if (files.empty()) {
+            throw std::runtime_error("No track data in " + pattern);
+        }
+
+        size_t perTrack = (static_cast<size_t>(bikes) + files.size() - 1) / files.size();
+        for (size_t i = 0; i < files.size() && i < static_cast<size_t>(bikes); ++i) {
+            tracks.emplace_back(new CSVHALManager(static_cast<int>(perTrack)));
+            tracks.back()->initialise(files[i]);
+        }
+    }
+
+    // HAL manager replaying a bike's track (bikes counted from 0)
+    CSVHALManager& hal(int bike) {
+        return *tracks[static_cast<size_t>(bike) % tracks.size()];
+    }
+
+    // The bike's port on that manager
+    int port(int bike) const {
+        return bike / static_cast<int>(tracks.size());
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // One ingest worker, each owning a shard of the fleet, per core by default
+    size_t ingestWorkers = std::max(1u, std::thread::hardware_concurrency());
+    LogLevel logLevel = LogLevel::Info;
+    int debugSampleRate = 1;
+    std::string journalDirectory = "data/state";
+    std::string geofenceFile = "data/geofences.geojson";
+    int simulatedBikes = 1;
+    int samplePeriod = 2000;
+    std::vector<int> udpPorts{8081};
+    PipelineOptions pipeline;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--ingest-workers") {
+            ingestWorkers = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        } else if (option == "--log-level") {
+            if (!parseLogLevel(argv[i + 1], logLevel)) {
+                LOG_WARNING("Unknown log level '" << argv[i + 1] << "', using info");
+            }
+        } else if (option == "--log-sample") {
+            // Keep one in N debug lines
+            debugSampleRate = std::max(1, std::atoi(argv[i + 1]));
+        } else if (option == "--journal-dir") {
+            // "none" keeps the fleet in memory only
+            journalDirectory = argv[i + 1];
+        } else if (option == "--geofences") {
+            // GeoJSON polygons checked against every position update
+            geofenceFile = argv[i + 1];
+        } else if (option == "--sim-bikes") {
+            // eBikes simulated inside the gateway from the recorded tracks
+            simulatedBikes = std::max(0, std::atoi(argv[i + 1]));
+        } else if (option == "--sim-period-ms") {
+            // How often each simulated eBike's GPS is sampled
+            samplePeriod = std::max(1, std::atoi(argv[i + 1]));
+        } else if (option == "--udp-ports") {
+            // Ports receiving eBike reports, all served by one receive thread
+            if (!parsePorts(argv[i + 1], udpPorts)) {
+                LOG_WARNING("Invalid UDP ports '" << argv[i + 1] << "', using 8081");
+            }
+        } else if (option == "--coalesce-ms") {
+            // Collapse each bike's reports within this many milliseconds to the newest
+            pipeline.coalesceTick = std::chrono::milliseconds(std::max(0, std::atoi(argv[i + 1])));
+        } else if (option == "--overload-policy") {
+            // What the ingest pipeline drops when it cannot keep up
+            OverloadPolicy policy;
+            if (!parseOverloadPolicy(argv[i + 1], policy)) {
+                LOG_WARNING("Unknown overload policy '" << argv[i + 1] << "', using coalesce");
+            } else {
+                pipeline.applyPolicy = policy;
+                pipeline.receivePolicy = policy == OverloadPolicy::DropNewest ?
+                    OverloadPolicy::DropNewest : OverloadPolicy::DropOldest;
+            }
+        }
+    }
+    Logger::instance().setLevel(logLevel);
+    Logger::instance().setDebugSampleRate(static_cast<uint32_t>(debugSampleRate));
+
+    // Latest state of every eBike, shared by the socket and web servers
+    FleetStore fleet(ingestWorkers);
+
+    // Recent track of every eBike, served at /ebikes/{id}/track
+    FleetHistory history(fleet);
+
+    // Service areas and no-parking zones; the gateway runs without them if they cannot be loaded
+    GeofenceIndex geofenceIndex;
+    try {
+        size_t loaded = geofenceIndex.loadGeoJSON(geofenceFile);
+        LOG_INFO("Loaded " << loaded << " geofences from " << geofenceFile);
+    } catch (const std::exception& ex) {
+        LOG_WARNING("No geofences loaded: " << ex.what());
+    }
+    GeofenceEngine geofences(fleet, std::move(geofenceIndex));
     
     try {
-        // Create HAL Manager with 1 port for the GPS sensor
-        CSVHALManager halManager(1);
-        
-        // Initialize with the CSV data file (should be in the data directory)
-        halManager.initialise("data/sim-eBike-1.csv");
-        
-        // Create and attach a GPS sensor to port 0
-        auto gpsSensor = std::make_shared<GPSSensor>("GPS_001");
-        halManager.attachDevice(0, gpsSensor);
-        
-        std::cout << "Device attached to port 0." << std::endl;
+        // Sample a GPS sensor per simulated eBike, each replaying a recorded
+        // track, and report the fixes to the fleet as eBikes 1, 2, ...
+        std::unique_ptr<SimulatedFleet> simulated;
+        if (simulatedBikes > 0) {
+            simulated.reset(new SimulatedFleet("data/sim-eBike-*.csv", simulatedBikes));
+        }
+        SensorScheduler scheduler; // Stopped before the simulated ports go away
+        for (int bike = 0; bike < simulatedBikes; ++bike) {
+            char sensorId[16];
+            std::snprintf(sensorId, sizeof(sensorId), "GPS_%03d", bike + 1);
+            auto gpsSensor = std::make_shared<GPSSensor>(sensorId);
+            CSVHALManager& halManager = simulated->hal(bike);
+            int port = simulated->port(bike);
+            halManager.attachDevice(port, gpsSensor);
+
+            int id = bike + 1;
+            scheduler.schedule(halManager, port, std::chrono::milliseconds(samplePeriod),
+                [&fleet, gpsSensor, id](int, const double* values, int count) {
+                    if (count != 2) {
+                        return;
+                    }
+                    GPSFix fix{values[0], values[1]};
+                    fleet.updatePosition(id, fix.lat, fix.lon, EBikeStatus::Unlocked);
+
+                    // Only formatted when debug logging is enabled
+                    LOG_DEBUG(gpsSensor->format(fix));
+                });
+        }
+        LOG_INFO("Simulating " << simulatedBikes << " eBikes, sampled every " << samplePeriod << " ms");
         
         // Replace 0 with your allocated port as per specifications
         int port = 8080;
         
+        // Restore the fleet from disk, then journal every change to it
+        std::unique_ptr<FleetJournal> journal;
+        if (journalDirectory != "none") {
+            journal.reset(new FleetJournal(fleet, journalDirectory));
+            auto recoveryStart = std::chrono::steady_clock::now();
+            size_t records = journal->recover();
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - recoveryStart);
+            LOG_INFO("Recovered " << fleet.size() << " eBikes from " << records << " journal records in "
+                << elapsed.count() << " ms");
+            geofences.seed();
+            journal->start();
+        }
+        
         // Create instance of the server class
-        WebServer webServer(ebikes);
+        web::WebServer webServer(fleet, history, geofences);
+        
+        // Start the UDP socket server receiving eBike reports
+        SocketServer socketServer(fleet, udpPorts, pipeline);
+        socketServer.start();
         
-        // Start the data update thread
-        std::thread updateThread(updateEbikeData, ebikes, std::ref(halManager), gpsSensor);
-        updateThread.detach();
+        // Start sampling the simulated eBikes
+        scheduler.start();
         
         // Start the web server
-        std::cout << "Starting web server on port " << port << std::endl;
+        LOG_INFO("Starting web server on port " << port);
         webServer.start(port);
-        
-        return 0;
+
+        // Stop sampling before the fleet goes away
+        scheduler.stop();
     } catch (const Poco::Exception& ex) {
-        std::cerr << "Server error (Poco): " << ex.displayText() << std::endl;
+        LOG_ERROR("Server error (Poco): " << ex.displayText());
+        Logger::instance().shutdown();
         return 1;
     } catch (const std::exception& ex) {
-        std::cerr << "Server error: " << ex.what() << std::endl;
+        LOG_ERROR("Server error: " << ex.what());
+        Logger::instance().shutdown();
         return 1;
     }
     
+    // Write out any queued log lines before exiting
+    Logger::instance().shutdown();
     return 0;
 }
\ No newline at end of file
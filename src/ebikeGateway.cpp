@@ -1,23 +1,25 @@
 #include "web/WebServer.h"
-#include <iostream>
+#include "Logger.h"
 
 int main() {
-    // Create a reference to a Poco JSON array to store the ebike objects
-    Poco::JSON::Array::Ptr ebikes = new Poco::JSON::Array();
+    // Latest state of every eBike
+    FleetStore fleet;
+    FleetHistory history(fleet);
+    GeofenceEngine geofences(fleet, GeofenceIndex());
 
     try {
         //Replace 0 with your allocated port as per specifications.
         int port = 0;
         
         // Create instances of the server class
-        WebServer webServer(ebikes);
+        web::WebServer webServer(fleet, history, geofences);
 
         // Start the server 
         webServer.start(port);
     
         return 0;
     } catch (const Poco::Exception& ex) {
-        std::cerr << "Server error (Poco): " << ex.displayText() << std::endl;
+        LOG_ERROR("Server error (Poco): " << ex.displayText());
         return 1;
     }
     return 0;
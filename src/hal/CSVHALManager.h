@@ -3,147 +3,253 @@
 
 #include "ISensor.h"
 #include "IActuator.h"
-#include <unordered_map>
+#include "CSVTable.h"
+#include "../Logger.h"
+#include <mutex>
+#include <string>
 #include <stdexcept>
-#include <iostream>
-#include <fstream>
-#include <sstream>
 #include <memory>
 #include <vector>
+#include <cstring>
+#include <type_traits>
 
+// How a CSV recording is loaded
+enum class CSVLoadMode {
+    Mapped, // Map the file and parse it once into typed columns
+    Streaming // Read rows on demand, never holding the whole file
+};
+
+// CSVHALManager: Simulated hardware ports that replay a CSV recording.
+// Each port keeps its own cursor into the recording, and a sensor reads
+// its own range of columns (by default starting at its ID), so several
+// sensors can replay the same file independently. Every port has its own
+// lock: reads on different ports never contend. initialise() must not run
+// concurrently with reads.
 class CSVHALManager {
 private:
-    std::vector<std::vector<std::string>> data; // CSV data
-    std::unordered_map<int, std::shared_ptr<IDevice> > portDeviceMap; // Port ID -> Device (generic pointer)
-    size_t sequence; // Current sequence (row index)
+    struct Port {
+        std::mutex mutex;
+        std::shared_ptr<IDevice> device; // Attached device, if any
+        const ISensor* sensor = nullptr; // The device, if it is a sensor
+        size_t firstColumn = 0; // First CSV column read by the sensor
+        size_t sequence = 0; // Current sequence (row index)
+        std::unique_ptr<CSVStreamReader> stream; // Port's reader (streaming mode)
+        CSVRow streamRow; // Row most recently read from the stream
+    };
+
+    CSVTable table; // CSV data (mapped mode)
+    std::string streamPath; // CSV file replayed by each port (streaming mode)
+    std::vector<std::unique_ptr<Port>> ports; // Port ID -> Port
     int numPorts; // Total number of ports
 
-    std::vector<uint8_t> convertToByteVector(const std::vector<std::string>& stringVector) {
-        std::vector<uint8_t> byteVector;
-        for (size_t i = 0; i < stringVector.size(); ++i) {
-            for (char ch : stringVector[i]) {
-                byteVector.push_back(static_cast<uint8_t>(ch));
+    Port& getPort(int portId) const {
+        if (portId < 0 || portId >= numPorts) {
+            throw std::runtime_error("No device attached to port.");
+        }
+        return *ports[portId];
+    }
+
+    // Advance the port's cursor to its next row and call
+    // visit(i, row, column) for each of the sensor's columns; returns the dimension
+    template <typename Visitor>
+    int readRow(int portId, Visitor visit) {
+        Port& port = getPort(portId);
+        std::lock_guard<std::mutex> lock(port.mutex);
+
+        // Check if the port has a device attached
+        if (!port.device) {
+            throw std::runtime_error("No device attached to the specified port.");
+        }
+
+        // Check if the attached device is a sensor
+        if (!port.sensor) {
+            throw std::runtime_error("The device attached to the port is not a sensor and cannot read data.");
+        }
+
+        if (!streamPath.empty()) {
+            if (!port.stream) {
+                port.stream.reset(new CSVStreamReader(streamPath));
+            }
+            if (!port.stream->next(port.streamRow)) {
+                throw std::out_of_range("No more data available.");
             }
-            
-            // Add separator between coordinates, but not after the last coordinate
-            if (i < stringVector.size() - 1) {
-                byteVector.push_back(static_cast<uint8_t>(';'));
+            visitColumns(port, port.streamRow, visit);
+        } else {
+            // Ensure the sequence is within bounds
+            if (port.sequence >= table.rowCount()) {
+                throw std::out_of_range("No more data available.");
+            }
+            visitColumns(port, CSVTableRow(table, port.sequence), visit);
+        }
+
+        port.sequence++; // Increment sequence after reading
+        return port.sensor->getDimension();
+    }
+
+    // Read the sensor's columns from a row
+    template <typename Row, typename Visitor>
+    static void visitColumns(const Port& port, const Row& row, Visitor& visit) {
+        for (int i = 0; i < port.sensor->getDimension(); ++i) {
+            size_t columnIndex = port.firstColumn + static_cast<size_t>(i);
+            if (columnIndex >= row.size()) {
+                throw std::out_of_range("Column index out of range.");
             }
+            visit(i, row, columnIndex);
         }
-        return byteVector;
     }
 
 public:
     // Constructor
-   CSVHALManager(int numPorts) : sequence(0), numPorts(numPorts) {
+   CSVHALManager(int numPorts) : numPorts(numPorts) {
             if (numPorts <= 0) {
                 throw std::invalid_argument("Number of ports must be greater than 0.");
             }
+            for (int i = 0; i < numPorts; ++i) {
+                ports.emplace_back(new Port);
+            }
     }
     
-    // Initialise the CSV file
-    void initialise(const std::string& filePath) {
-        std::ifstream csvFile(filePath);
-        if (!csvFile.is_open()) {
-            throw std::runtime_error("Failed to open CSV file: " + filePath);
+    // Initialise the CSV file and rewind every port. Mapped mode parses
+    // numeric columns once into arrays of doubles; streaming mode gives
+    // each port its own reader, reading a row per read call.
+    void initialise(const std::string& filePath, CSVLoadMode mode = CSVLoadMode::Mapped) {
+        if (mode == CSVLoadMode::Streaming) {
+            // Fail now rather than on the first read if the file is missing
+            CSVStreamReader check(filePath);
+            streamPath = filePath;
+        } else {
+            streamPath.clear();
+            try {
+                table.load(filePath);
+            } catch (const std::runtime_error&) {
+                throw std::runtime_error("Failed to open CSV file: " + filePath);
+            }
         }
 
-        std::string line;
-        
-        while (std::getline(csvFile, line)) {
-            std::istringstream lineStream(line);
-            std::string cell;
-            std::vector<std::string> row;
-
-            while (std::getline(lineStream, cell, ',')) {
-                row.push_back(cell);
-            }
-            data.push_back(row);
+        for (auto& port : ports) {
+            std::lock_guard<std::mutex> lock(port->mutex);
+            port->sequence = 0;
+            port->stream.reset();
         }
-        csvFile.close();
     }
 
      // Get the device attached to a port
     std::shared_ptr<IDevice> getDevice(int portId) const {
-        if (portDeviceMap.find(portId) == portDeviceMap.end()) {
+        Port& port = getPort(portId);
+        std::lock_guard<std::mutex> lock(port.mutex);
+        if (!port.device) {
             throw std::runtime_error("No device attached to port.");
         }
-        auto device = portDeviceMap.at(portId);
-        return std::dynamic_pointer_cast<IDevice>(device);
+        return port.device;
     }
 
-    // Attach a device to a port
-    void attachDevice(int portId, const std::shared_ptr<IDevice>& device)  {
+    // Attach a device to a port. A sensor reads getDimension() columns
+    // starting at its ID, or at firstColumn if one is given.
+    void attachDevice(int portId, const std::shared_ptr<IDevice>& device, int firstColumn = -1)  {
         if (portId < 0 || portId >= numPorts) {
             throw std::out_of_range("Invalid port ID.");
         }
-        if (portDeviceMap.find(portId) != portDeviceMap.end()) {
+        Port& port = *ports[portId];
+        std::lock_guard<std::mutex> lock(port.mutex);
+        if (port.device) {
             throw std::runtime_error("Port is already busy.");
         }
-        portDeviceMap[portId] = device;
-        std::cout << "[CSVHALManager] Device attached to port " << portId << ".\n";
+        port.device = device;
+        port.sensor = dynamic_cast<const ISensor*>(device.get());
+        port.firstColumn = static_cast<size_t>(firstColumn >= 0 ? firstColumn : (port.sensor ? port.sensor->getId() : 0));
+        port.sequence = 0;
+        port.stream.reset();
+        LOG_INFO("[CSVHALManager] Device attached to port " << portId << ".");
     }
 
     // Release a device from a port
     void releaseDevice(int portId)  {
-        if (portDeviceMap.find(portId) == portDeviceMap.end()) {
+        Port& port = getPort(portId);
+        std::lock_guard<std::mutex> lock(port.mutex);
+        if (!port.device) {
             throw std::runtime_error("No device attached to port.");
         }
-        portDeviceMap.erase(portId);
-        std::cout << "[CSVHALManager] Device released from port " << portId << ".\n";
+        port.device.reset();
+        port.sensor = nullptr;
+        port.stream.reset();
+        LOG_INFO("[CSVHALManager] Device released from port " << portId << ".");
     }
 
     // Check if a port is busy
     bool isBusy(int portId) const  {
-        return portDeviceMap.find(portId) != portDeviceMap.end();
+        if (portId < 0 || portId >= numPorts) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(ports[portId]->mutex);
+        return ports[portId]->device != nullptr;
+    }
+
+    // Move a port's cursor back to the first row, e.g. to replay a track
+    void rewind(int portId) {
+        Port& port = getPort(portId);
+        std::lock_guard<std::mutex> lock(port.mutex);
+        port.sequence = 0;
+        port.stream.reset();
     }
 
     // Read data from a sensor
     std::vector<uint8_t> read(int portId)  {
-        // Check if the port has a device attached
-        if (portDeviceMap.find(portId) == portDeviceMap.end()) {
-            throw std::runtime_error("No device attached to the specified port.");
-        }
-
-        // Check if the attached device is a sensor
-        auto sensor = std::dynamic_pointer_cast<ISensor>(portDeviceMap[portId]);
-        if (!sensor) {
-            throw std::runtime_error("The device attached to the port is not a sensor and cannot read data.");
-        }
-
-        // Ensure the sequence is within bounds
-        if (sequence >= data.size()) {
-            throw std::out_of_range("No more data available.");
-        }
-
-        // Read the specified columns from the current row
-        std::vector<std::string> result;
-        
-        int columnIndex;
+        std::vector<uint8_t> result;
+        readRow(portId, [&](int i, const auto& row, size_t columnIndex) {
+            if (i > 0) {
+                result.push_back(static_cast<uint8_t>(';'));
+            }
+            row.appendCell(result, columnIndex);
+        });
+        return result;
+    }
 
-        for (int i = 0; i < sensor->getDimension(); ++i) {
-            
-            columnIndex = sensor->getId() + i;
+    // Read data from a sensor into a caller-provided buffer, in the same
+    // ';'-separated form as read(); returns the number of bytes written
+    size_t readInto(int portId, uint8_t* buffer, size_t capacity) {
+        CSV::Buffer out{buffer, capacity, 0};
+        readRow(portId, [&](int i, const auto& row, size_t columnIndex) {
+            if (i > 0) {
+                const char separator = ';';
+                CSV::append(out, &separator, &separator + 1);
+            }
+            row.appendCell(out, columnIndex);
+        });
+        return out.length;
+    }
 
-            if (columnIndex >= static_cast<int>(data[0].size())) {
-                throw std::out_of_range("Column index out of range.");
+    // Read a sensor's values into a caller-provided array of at least
+    // getDimension() doubles; returns the number of values written
+    int readInto(int portId, double* values, int capacity) {
+        return readRow(portId, [&](int i, const auto& row, size_t columnIndex) {
+            if (i >= capacity) {
+                throw std::length_error("Read buffer is too small.");
             }
-            result.push_back(data[sequence][columnIndex]);
-        }
+            if (!row.toNumber(columnIndex, values[i])) {
+                throw std::runtime_error("Sensor column is not numeric.");
+            }
+        });
+    }
 
-        sequence++; // Increment sequence after reading
-        
-        
-        return convertToByteVector(result);
+    // Read a sensor's values straight into a struct of doubles laid out
+    // like its columns, e.g. readAs<GPSFix>(0)
+    template <typename T>
+    T readAs(int portId) {
+        static_assert(std::is_trivially_copyable<T>::value && sizeof(T) % sizeof(double) == 0,
+                      "readAs needs a struct of doubles");
+        const int count = static_cast<int>(sizeof(T) / sizeof(double));
+        double values[count];
+        if (readInto(portId, values, count) != count) {
+            throw std::runtime_error("Sensor dimension does not match the requested type.");
+        }
+        T reading;
+        std::memcpy(&reading, values, sizeof(T));
+        return reading;
     }
 
     // Write data to an actuator
     void write(int portId, const std::vector<uint8_t>& data) {
-        if (portDeviceMap.find(portId) == portDeviceMap.end()) {
-            throw std::runtime_error("No device attached to port.");
-        }
-
-        auto device = portDeviceMap[portId];
+        std::shared_ptr<IDevice> device = getDevice(portId);
 
         // Check if the device is an actuator
         auto actuator = std::dynamic_pointer_cast<IActuator>(device);
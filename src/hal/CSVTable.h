@@ -0,0 +1,348 @@
+#ifndef CSVTABLE_H
+#define CSVTABLE_H
+
+#include "MappedFile.h"
+#include "../Numbers.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace CSV {
+
+// A caller-provided buffer that cell text is copied into
+struct Buffer {
+    uint8_t* data;
+    size_t capacity;
+    size_t length;
+};
+
+inline void append(std::vector<uint8_t>& out, const char* begin, const char* end) {
+    out.insert(out.end(), begin, end);
+}
+
+// Copy into a caller-provided buffer; throws if it would overflow
+inline void append(Buffer& out, const char* begin, const char* end) {
+    size_t length = static_cast<size_t>(end - begin);
+    if (length > out.capacity - out.length) {
+        throw std::length_error("Read buffer is too small.");
+    }
+    std::memcpy(out.data + out.length, begin, length);
+    out.length += length;
+}
+
+// Append the text of a number, in its shortest form that reads back exactly
+template <typename Output>
+void appendNumber(Output& out, double value) {
+    char buffer[Numbers::MaxLength];
+    append(out, buffer, Numbers::format(buffer, value));
+}
+
+// Call visit(cellBegin, cellEnd) for each comma-separated cell of a line.
+// A trailing '\r' is ignored, and so is an empty cell after a trailing
+// comma (matching how std::getline splits the line).
+template <typename Visitor>
+void splitLine(const char* begin, const char* end, Visitor visit) {
+    if (end > begin && end[-1] == '\r') {
+        --end;
+    }
+    const char* cell = begin;
+    while (cell < end) {
+        const char* comma = static_cast<const char*>(std::memchr(cell, ',', end - cell));
+        const char* cellEnd = comma ? comma : end;
+        visit(cell, cellEnd);
+        cell = comma ? comma + 1 : end;
+    }
+}
+
+// Call visit(lineBegin, lineEnd) for each non-empty line of a buffer
+template <typename Visitor>
+void splitLines(const char* begin, const char* end, Visitor visit) {
+    const char* line = begin;
+    while (line < end) {
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        const char* lineEnd = newline ? newline : end;
+        if (lineEnd > line && !(lineEnd - line == 1 && *line == '\r')) {
+            visit(line, lineEnd);
+        }
+        line = newline ? newline + 1 : end;
+    }
+}
+
+}
+
+// CSVTable: A CSV recording held column by column.
+// A column whose every cell is a number is parsed once into a contiguous
+// array of doubles; any other column keeps its text in a single buffer.
+// Loading maps the file and walks it twice: once to size and type the
+// columns, once to fill them, so nothing is allocated per cell.
+class CSVTable {
+private:
+    struct Column {
+        bool numeric = true;
+        std::vector<double> values; // Numeric columns
+        std::string text; // Text columns: every cell, back to back
+        std::vector<size_t> ends; // Text columns: end of each cell in text
+    };
+
+    std::vector<Column> columns;
+    size_t rows = 0;
+
+public:
+    // Load a CSV file, replacing any previous contents
+    void load(const std::string& filePath) {
+        MappedFile file(filePath);
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+        columns.clear();
+        rows = 0;
+
+        // First pass: count rows and find the columns that are all numbers
+        CSV::splitLines(begin, end, [&](const char* line, const char* lineEnd) {
+            size_t column = 0;
+            CSV::splitLine(line, lineEnd, [&](const char* cell, const char* cellEnd) {
+                if (column == columns.size()) {
+                    columns.emplace_back();
+                    // Rows before this one have no cell in the new column
+                    columns.back().numeric = rows == 0;
+                }
+                double value;
+                if (columns[column].numeric && !Numbers::parseAll(cell, cellEnd, value)) {
+                    columns[column].numeric = false;
+                }
+                ++column;
+            });
+            for (; column < columns.size(); ++column) {
+                columns[column].numeric = false;
+            }
+            ++rows;
+        });
+
+        for (Column& column : columns) {
+            if (column.numeric) {
+                column.values.reserve(rows);
+            } else {
+                column.ends.reserve(rows);
+            }
+        }
+
+        // Second pass: fill the columns
+        CSV::splitLines(begin, end, [&](const char* line, const char* lineEnd) {
+            size_t index = 0;
+            CSV::splitLine(line, lineEnd, [&](const char* cell, const char* cellEnd) {
+                Column& column = columns[index++];
+                if (column.numeric) {
+                    double value = 0;
+                    Numbers::parseAll(cell, cellEnd, value);
+                    column.values.push_back(value);
+                } else {
+                    column.text.append(cell, cellEnd);
+                    column.ends.push_back(column.text.size());
+                }
+            });
+            // Missing cells are empty
+            for (; index < columns.size(); ++index) {
+                columns[index].ends.push_back(columns[index].text.size());
+            }
+        });
+    }
+
+    size_t rowCount() const {
+        return rows;
+    }
+
+    size_t columnCount() const {
+        return columns.size();
+    }
+
+    bool isNumeric(size_t column) const {
+        return columns[column].numeric;
+    }
+
+    // Value of a cell in a numeric column
+    double number(size_t row, size_t column) const {
+        return columns[column].values[row];
+    }
+
+    // Text of a cell in a text column
+    std::string_view text(size_t row, size_t column) const {
+        const Column& c = columns[column];
+        size_t begin = row == 0 ? 0 : c.ends[row - 1];
+        return std::string_view(c.text.data() + begin, c.ends[row] - begin);
+    }
+
+    // Value of any cell; text cells are parsed, returns false if not a number
+    bool toNumber(size_t row, size_t column, double& value) const {
+        if (columns[column].numeric) {
+            value = number(row, column);
+            return true;
+        }
+        std::string_view cell = text(row, column);
+        return Numbers::parseAll(cell.data(), cell.data() + cell.size(), value);
+    }
+
+    // Append the text of any cell
+    template <typename Output>
+    void appendCell(Output& out, size_t row, size_t column) const {
+        if (columns[column].numeric) {
+            CSV::appendNumber(out, number(row, column));
+        } else {
+            std::string_view cell = text(row, column);
+            CSV::append(out, cell.data(), cell.data() + cell.size());
+        }
+    }
+};
+
+// CSVTableRow: One row of a table, read through the same calls as a CSVRow
+class CSVTableRow {
+private:
+    const CSVTable& table;
+    size_t row;
+
+public:
+    CSVTableRow(const CSVTable& table, size_t row) : table(table), row(row) {}
+
+    size_t size() const {
+        return table.columnCount();
+    }
+
+    bool toNumber(size_t column, double& value) const {
+        return table.toNumber(row, column, value);
+    }
+
+    template <typename Output>
+    void appendCell(Output& out, size_t column) const {
+        table.appendCell(out, row, column);
+    }
+};
+
+// CSVRow: One row read from a stream; cells point into the row's own copy
+// of the line.
+class CSVRow {
+private:
+    std::string line;
+    std::vector<std::pair<size_t, size_t>> cells; // Begin and end of each cell in line
+
+public:
+    void assign(const char* begin, const char* end) {
+        line.assign(begin, end);
+        cells.clear();
+        const char* base = line.data();
+        CSV::splitLine(base, base + line.size(), [&](const char* cell, const char* cellEnd) {
+            cells.emplace_back(cell - base, cellEnd - base);
+        });
+    }
+
+    size_t size() const {
+        return cells.size();
+    }
+
+    std::string_view text(size_t column) const {
+        return std::string_view(line.data() + cells[column].first, cells[column].second - cells[column].first);
+    }
+
+    // Value of a cell; returns false if it is not a number
+    bool toNumber(size_t column, double& value) const {
+        std::string_view cell = text(column);
+        return Numbers::parseAll(cell.data(), cell.data() + cell.size(), value);
+    }
+
+    // Append the text of a cell
+    template <typename Output>
+    void appendCell(Output& out, size_t column) const {
+        std::string_view cell = text(column);
+        CSV::append(out, cell.data(), cell.data() + cell.size());
+    }
+};
+
+// CSVStreamReader: Reads a CSV file one row at a time through a fixed-size
+// buffer, so recordings of any size are replayed without being held in
+// memory. Lines longer than the buffer grow it.
+class CSVStreamReader {
+private:
+    static const size_t ChunkSize = 1 << 20;
+
+    int fd;
+    std::vector<char> buffer;
+    size_t start = 0; // First unread byte in buffer
+    size_t end = 0; // End of the bytes read into buffer
+    bool atEnd = false;
+
+    // Read more of the file after the unread bytes; returns false at the end
+    bool fill() {
+        if (atEnd) {
+            return false;
+        }
+        if (start > 0) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+        ssize_t bytes = ::read(fd, buffer.data() + end, buffer.size() - end);
+        if (bytes < 0) {
+            throw std::runtime_error("Failed to read CSV file.");
+        }
+        if (bytes == 0) {
+            atEnd = true;
+            return false;
+        }
+        end += static_cast<size_t>(bytes);
+        return true;
+    }
+
+public:
+    explicit CSVStreamReader(const std::string& filePath) : buffer(ChunkSize) {
+        fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open CSV file: " + filePath);
+        }
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ~CSVStreamReader() {
+        ::close(fd);
+    }
+
+    CSVStreamReader(const CSVStreamReader&) = delete;
+    CSVStreamReader& operator=(const CSVStreamReader&) = delete;
+
+    // Read the next non-empty row; returns false at the end of the file
+    bool next(CSVRow& row) {
+        while (true) {
+            size_t scanned = start;
+            const char* newline = nullptr;
+            while (true) {
+                newline = static_cast<const char*>(std::memchr(buffer.data() + scanned, '\n', end - scanned));
+                if (newline) {
+                    break;
+                }
+                scanned = end - start;
+                if (!fill()) {
+                    break;
+                }
+            }
+
+            const char* lineBegin = buffer.data() + start;
+            const char* lineEnd = newline ? newline : buffer.data() + end;
+            if (lineBegin == lineEnd && !newline) {
+                return false;
+            }
+            start = newline ? static_cast<size_t>(newline - buffer.data()) + 1 : end;
+
+            if (lineEnd > lineBegin && !(lineEnd - lineBegin == 1 && *lineBegin == '\r')) {
+                row.assign(lineBegin, lineEnd);
+                return true;
+            }
+        }
+    }
+};
+
+#endif // CSVTABLE_H
@@ -2,8 +2,11 @@
 #define ISENSOR_H
 
 #include "IDevice.h"
+#include "../Numbers.h"
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <cstddef>
 
 class ISensor : public IDevice {
     
@@ -11,6 +14,25 @@ public:
     virtual ~ISensor() = default;
     virtual int getDimension() const = 0;
     virtual std::string format(std::vector<uint8_t> reading) = 0;
+
+    // Decode a ';'-separated byte reading into getDimension() values
+    // without copying it; returns false if the reading is malformed
+    virtual bool decode(const uint8_t* reading, size_t length, double* values) const {
+        const char* cell = reinterpret_cast<const char*>(reading);
+        const char* end = cell + length;
+        for (int i = 0; i < getDimension(); ++i) {
+            const char* next = Numbers::parse(cell, end, values[i]);
+            if (!next) {
+                return false;
+            }
+            bool last = i == getDimension() - 1;
+            if (last ? next != end : (next == end || *next != ';')) {
+                return false;
+            }
+            cell = next + 1;
+        }
+        return true;
+    }
 };
 
 #endif // ISENSOR_H
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// MappedFile: A read-only memory mapping of a whole file.
+// Pages are loaded by the kernel as they are touched, so parsing a large
+// recording needs no read buffer and no copy of the file.
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+
+public:
+    // Map a file; throws if it cannot be opened or mapped
+    explicit MappedFile(const std::string& filePath) : bytes(nullptr), length(0) {
+        int fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + filePath);
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to read file size: " + filePath);
+        }
+        length = static_cast<size_t>(info.st_size);
+
+        // An empty file cannot be mapped and has nothing to parse
+        if (length > 0) {
+            void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map file: " + filePath);
+            }
+            bytes = static_cast<const char*>(mapping);
+            ::madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (bytes) {
+            ::munmap(const_cast<char*>(bytes), length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+#endif // MAPPEDFILE_H
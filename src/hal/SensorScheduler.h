@@ -0,0 +1,269 @@
+#ifndef SENSORSCHEDULER_H
+#define SENSORSCHEDULER_H
+
+#include "CSVHALManager.h"
+#include "../Logger.h"
+#include "../Metrics.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+// Timing and threads of a SensorScheduler
+struct SensorSchedulerOptions {
+    std::chrono::milliseconds tick{10}; // Timer wheel resolution; periods are rounded to whole ticks
+    size_t slots = 512; // Timer wheel slots; a period of up to slots ticks costs no extra laps
+    size_t workers = 2; // Threads reading sensors and running callbacks
+    bool replay = true; // Rewind a port at the end of its recording instead of stopping
+};
+
+// SensorScheduler: Samples sensors attached to CSVHALManager ports, each
+// at its own period, and hands every reading to a callback.
+//
+// Sampling times live in a hashed timer wheel: one slot per tick, so the
+// timer thread only looks at the sensors due in the current tick however
+// many are scheduled. Due times are counted in whole ticks from start(),
+// never from when the previous sample finished, so the timing does not
+// drift. Due sensors are read by a small worker pool; a sensor still
+// being read when it is next due skips that sample (an overrun).
+//
+// stop() (or the destructor) stops the timer and joins every thread;
+// samples not yet started are dropped.
+class SensorScheduler {
+public:
+    // Called with the port and the sensor's values
+    typedef std::function<void(int portId, const double* values, int count)> Callback;
+
+    explicit SensorScheduler(const SensorSchedulerOptions& options = SensorSchedulerOptions())
+        : options(options), wheel(std::max<size_t>(1, options.slots)),
+          samples(Metrics::instance().counter("gateway_sensor_samples_total", "Sensor readings taken")),
+          overruns(Metrics::instance().counter("gateway_sensor_overruns_total",
+              "Sensor samples skipped because the previous reading had not finished")),
+          readErrors(Metrics::instance().counter("gateway_sensor_read_errors_total",
+              "Sensor readings that failed")),
+          scheduled(Metrics::instance().gauge("gateway_sensor_tasks", "Sensors being sampled")) {
+        if (options.tick.count() <= 0) {
+            throw std::invalid_argument("Scheduler tick must be positive.");
+        }
+    }
+
+    ~SensorScheduler() {
+        stop();
+    }
+
+    SensorScheduler(const SensorScheduler&) = delete;
+    SensorScheduler& operator=(const SensorScheduler&) = delete;
+
+    // Sample the sensor on a port every period; returns an ID for cancel().
+    // The first sample is taken phase into the period. By default phases
+    // are spread over the period, so sensors sharing a period do not all
+    // fire in the same tick.
+    int schedule(CSVHALManager& hal, int portId, std::chrono::milliseconds period, Callback callback,
+                 std::chrono::milliseconds phase = std::chrono::milliseconds(-1)) {
+        auto sensor = std::dynamic_pointer_cast<ISensor>(hal.getDevice(portId));
+        if (!sensor) {
+            throw std::runtime_error("The device attached to the port is not a sensor and cannot read data.");
+        }
+
+        std::shared_ptr<Task> task(new Task);
+        task->hal = &hal;
+        task->portId = portId;
+        task->values.resize(static_cast<size_t>(sensor->getDimension()));
+        task->callback = std::move(callback);
+        task->periodTicks = std::max<uint64_t>(1, static_cast<uint64_t>(
+            (period.count() + options.tick.count() / 2) / options.tick.count()));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        task->id = nextId++;
+        uint64_t phaseTicks = phase.count() >= 0 ?
+            static_cast<uint64_t>(phase.count() / options.tick.count()) :
+            static_cast<uint64_t>(task->id) * 2654435761u % task->periodTicks;
+        task->dueTick = currentTick + 1 + phaseTicks % task->periodTicks;
+        insert(task);
+        tasks[task->id] = task;
+        scheduled.set(static_cast<int64_t>(tasks.size()));
+        return task->id;
+    }
+
+    // Stop sampling a sensor; a reading already under way still completes
+    void cancel(int taskId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = tasks.find(taskId);
+        if (found == tasks.end()) {
+            return;
+        }
+        // Dropped from the wheel when its slot next comes round
+        found->second->cancelled = true;
+        tasks.erase(found);
+        scheduled.set(static_cast<int64_t>(tasks.size()));
+    }
+
+    size_t taskCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tasks.size();
+    }
+
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running) {
+            return;
+        }
+        running = true;
+        epoch = std::chrono::steady_clock::now() - static_cast<int64_t>(currentTick) * options.tick;
+        for (size_t i = 0; i < std::max<size_t>(1, options.workers); ++i) {
+            threads.emplace_back(&SensorScheduler::workerLoop, this);
+        }
+        threads.emplace_back(&SensorScheduler::timerLoop, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+            for (auto& task : ready) {
+                task->busy = false;
+            }
+            ready.clear();
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+private:
+    struct Task {
+        int id = 0;
+        CSVHALManager* hal = nullptr;
+        int portId = 0;
+        uint64_t periodTicks = 1;
+        uint64_t dueTick = 0; // Next tick to sample at
+        std::vector<double> values; // Reading buffer, one value per sensor column
+        Callback callback;
+        std::atomic<bool> busy{false}; // Being read by a worker
+        std::atomic<bool> cancelled{false};
+    };
+
+    SensorSchedulerOptions options;
+    mutable std::mutex mutex; // Guards everything below
+    std::condition_variable wake; // Timer and workers wait here
+    std::vector<std::vector<std::shared_ptr<Task>>> wheel; // Tick % slots -> tasks due in that slot
+    std::unordered_map<int, std::shared_ptr<Task>> tasks; // Task ID -> task
+    std::deque<std::shared_ptr<Task>> ready; // Due tasks waiting for a worker
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point epoch; // When tick 0 started
+    uint64_t currentTick = 0; // Last tick processed
+    int nextId = 1;
+    bool running = false;
+    Counter& samples;
+    Counter& overruns;
+    Counter& readErrors;
+    Gauge& scheduled;
+
+    void insert(const std::shared_ptr<Task>& task) {
+        wheel[task->dueTick % wheel.size()].push_back(task);
+    }
+
+    void timerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::vector<std::shared_ptr<Task>> slot;
+        while (running) {
+            // Wait for the end of the next tick, measured from the epoch so
+            // late wakeups do not accumulate
+            auto tickEnd = epoch + static_cast<int64_t>(currentTick + 1) * options.tick;
+            if (wake.wait_until(lock, tickEnd, [&] { return !running; })) {
+                break;
+            }
+            ++currentTick;
+
+            slot.swap(wheel[currentTick % wheel.size()]);
+            bool dispatched = false;
+            for (auto& task : slot) {
+                if (task->cancelled) {
+                    continue;
+                }
+                if (task->dueTick > currentTick) {
+                    insert(task); // Due on a later lap of the wheel
+                    continue;
+                }
+                if (task->busy.exchange(true)) {
+                    overruns.increment();
+                } else {
+                    ready.push_back(task);
+                    dispatched = true;
+                }
+                task->dueTick += task->periodTicks;
+                insert(task);
+            }
+            slot.clear();
+            if (dispatched) {
+                wake.notify_all();
+            }
+        }
+    }
+
+    void workerLoop() {
+        while (true) {
+            std::shared_ptr<Task> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return !ready.empty() || !running; });
+                if (!running) {
+                    return;
+                }
+                task = std::move(ready.front());
+                ready.pop_front();
+            }
+            if (!task->cancelled) {
+                sample(*task);
+            }
+            task->busy = false;
+        }
+    }
+
+    void sample(Task& task) {
+        int count;
+        try {
+            count = readSensor(task);
+        } catch (const std::exception& e) {
+            readErrors.increment();
+            LOG_ERROR("[SensorScheduler] Error reading port " << task.portId << ": " << e.what());
+            return;
+        }
+        samples.increment();
+        try {
+            task.callback(task.portId, task.values.data(), count);
+        } catch (const std::exception& e) {
+            LOG_ERROR("[SensorScheduler] Error handling a reading from port " << task.portId << ": " << e.what());
+        }
+    }
+
+    int readSensor(Task& task) {
+        int capacity = static_cast<int>(task.values.size());
+        try {
+            return task.hal->readInto(task.portId, task.values.data(), capacity);
+        } catch (const std::out_of_range&) {
+            if (!options.replay) {
+                throw;
+            }
+        }
+        // End of the recording: start it again
+        task.hal->rewind(task.portId);
+        return task.hal->readInto(task.portId, task.values.data(), capacity);
+    }
+};
+
+#endif // SENSORSCHEDULER_H
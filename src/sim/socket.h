@@ -30,6 +30,9 @@ public:
     // Receive data from any source (standard UDP API)
     ssize_t recvfrom(void* buffer, size_t size, int flags, struct ::sockaddr_in& srcAddr);
 
+    // Underlying descriptor, e.g. to wait for readiness with epoll
+    int fd() const { return sockfd; }
+
 private:
     int sockfd;
     std::string unixPath;
@@ -0,0 +1,135 @@
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <ctime>
+#include <sys/stat.h>
+#include "ContentEncoding.h"
+
+// A static file held in memory with its compressed variants
+struct Asset {
+    std::string contentType;
+    std::string etag;
+    std::string lastModified; // HTTP date
+    std::string body;
+    std::string gzipBody;
+    std::string deflateBody;
+    time_t modifiedTime = 0;
+    off_t fileSize = 0;
+
+    const std::string& encodedBody(ContentEncoding encoding) const {
+        switch (encoding) {
+        case ContentEncoding::Gzip:
+            return gzipBody;
+        case ContentEncoding::Deflate:
+            return deflateBody;
+        default:
+            return body;
+        }
+    }
+};
+
+// AssetCache: Serves static files from memory. Each file is read and
+// compressed (at the highest level, since it is done once) on first use.
+// With a reload interval, the file's modification time is checked at most
+// once per interval and the asset is reloaded when the file changes.
+class AssetCache {
+public:
+    // A zero reload interval loads every file once for the life of the cache
+    explicit AssetCache(std::chrono::milliseconds reloadInterval = std::chrono::milliseconds(1000))
+        : _reloadInterval(reloadInterval) {}
+
+    AssetCache(const AssetCache&) = delete;
+    AssetCache& operator=(const AssetCache&) = delete;
+
+    // Get a file, loading it if it is not cached or has changed on disk;
+    // throws std::runtime_error if it cannot be read
+    std::shared_ptr<const Asset> get(const std::string& filePath) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry& entry = _entries[filePath];
+        auto now = std::chrono::steady_clock::now();
+
+        if (entry.asset) {
+            if (_reloadInterval.count() == 0 || now - entry.checkedAt < _reloadInterval) {
+                return entry.asset;
+            }
+            entry.checkedAt = now;
+            struct stat info;
+            if (::stat(filePath.c_str(), &info) != 0 ||
+                (info.st_mtime == entry.asset->modifiedTime && info.st_size == entry.asset->fileSize)) {
+                // Keep serving the cached copy if the file has gone
+                return entry.asset;
+            }
+        }
+
+        entry.asset = load(filePath);
+        entry.checkedAt = now;
+        return entry.asset;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const Asset> asset;
+        std::chrono::steady_clock::time_point checkedAt;
+    };
+
+    std::chrono::milliseconds _reloadInterval;
+    std::mutex _mutex;
+    std::map<std::string, Entry> _entries;
+
+    static std::shared_ptr<const Asset> load(const std::string& filePath) {
+        struct stat info;
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file || ::stat(filePath.c_str(), &info) != 0) {
+            throw std::runtime_error("Failed to open file: " + filePath);
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+
+        auto asset = std::make_shared<Asset>();
+        asset->body = contents.str();
+        asset->contentType = contentTypeOf(filePath);
+        asset->modifiedTime = info.st_mtime;
+        asset->fileSize = info.st_size;
+        asset->etag = "\"" + std::to_string(static_cast<long long>(info.st_mtime)) + "-" +
+            std::to_string(static_cast<long long>(info.st_size)) + "\"";
+
+        char date[64];
+        std::tm tmBuffer;
+        gmtime_r(&info.st_mtime, &tmBuffer);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tmBuffer);
+        asset->lastModified = date;
+
+        asset->gzipBody = compressBody(asset->body, ContentEncoding::Gzip, 9);
+        asset->deflateBody = compressBody(asset->body, ContentEncoding::Deflate, 9);
+        return asset;
+    }
+
+    static std::string contentTypeOf(const std::string& filePath) {
+        static const std::map<std::string, std::string> types = {
+            {".html", "text/html; charset=utf-8"},
+            {".css", "text/css"},
+            {".js", "application/javascript"},
+            {".json", "application/json"},
+            {".svg", "image/svg+xml"},
+            {".png", "image/png"},
+        };
+        size_t dot = filePath.rfind('.');
+        if (dot != std::string::npos) {
+            auto it = types.find(filePath.substr(dot));
+            if (it != types.end()) {
+                return it->second;
+            }
+        }
+        return "application/octet-stream";
+    }
+};
+
+#endif // ASSETCACHE_H
@@ -0,0 +1,104 @@
+#ifndef CONTENTENCODING_H
+#define CONTENTENCODING_H
+
+#include <string>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <Poco/DeflatingStream.h>
+
+// HTTP content codings the gateway can send
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+// Value of the Content-Encoding header, or "" for identity
+inline const char* contentEncodingName(ContentEncoding encoding) {
+    switch (encoding) {
+    case ContentEncoding::Gzip:
+        return "gzip";
+    case ContentEncoding::Deflate:
+        return "deflate";
+    default:
+        return "";
+    }
+}
+
+// Pick the coding to answer with from an Accept-Encoding header, e.g.
+// "gzip, deflate, br" or "deflate;q=0.5, gzip;q=0". A coding with q=0 is
+// refused, "*" stands for every coding not listed, and identity is
+// acceptable unless refused by name or by "*;q=0". gzip is preferred when
+// both are acceptable, since some clients mishandle raw deflate; with
+// preferIdentity (bodies too small to be worth compressing) identity is
+// chosen whenever it is acceptable. Returns false if none of the codings
+// the gateway can send is acceptable.
+inline bool chooseContentEncoding(const std::string& acceptEncoding, ContentEncoding& encoding,
+                                  bool preferIdentity = false) {
+    // Acceptability of each coding: -1 not listed, 0 refused, 1 accepted
+    int gzip = -1;
+    int deflate = -1;
+    int identity = -1;
+    int any = -1;
+    std::istringstream codings(acceptEncoding);
+    std::string coding;
+    while (std::getline(codings, coding, ',')) {
+        // Split "name;q=value"
+        std::string name = coding.substr(0, coding.find(';'));
+        std::string lowered;
+        for (char c : name) {
+            if (!std::isspace(static_cast<unsigned char>(c))) {
+                lowered += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+        }
+        size_t q = coding.find("q=");
+        int accepted = q != std::string::npos && std::atof(coding.c_str() + q + 2) <= 0 ? 0 : 1;
+        if (lowered == "gzip" || lowered == "x-gzip") {
+            gzip = accepted;
+        } else if (lowered == "deflate") {
+            deflate = accepted;
+        } else if (lowered == "identity") {
+            identity = accepted;
+        } else if (lowered == "*") {
+            any = accepted;
+        }
+    }
+
+    bool identityAccepted = identity == 1 || (identity == -1 && any != 0);
+    if (preferIdentity && identityAccepted) {
+        encoding = ContentEncoding::Identity;
+    } else if (gzip == 1 || (gzip == -1 && any == 1)) {
+        encoding = ContentEncoding::Gzip;
+    } else if (deflate == 1 || (deflate == -1 && any == 1)) {
+        encoding = ContentEncoding::Deflate;
+    } else {
+        encoding = ContentEncoding::Identity;
+        return identityAccepted;
+    }
+    return true;
+}
+
+// Compress a body; level is a zlib level, 1 (fastest) to 9 (smallest)
+inline std::string compressBody(const std::string& body, ContentEncoding encoding, int level = 6) {
+    if (encoding == ContentEncoding::Identity) {
+        return body;
+    }
+    std::ostringstream out;
+    // HTTP "deflate" is the zlib format, not a raw deflate stream
+    Poco::DeflatingOutputStream deflater(out, encoding == ContentEncoding::Gzip ?
+        Poco::DeflatingStreamBuf::STREAM_GZIP : Poco::DeflatingStreamBuf::STREAM_ZLIB, level);
+    deflater.write(body.data(), static_cast<std::streamsize>(body.size()));
+    deflater.close();
+    return out.str();
+}
+
+// ETag of an encoded variant, so caches never mix up variants of one resource
+inline std::string encodedETag(const std::string& etag, ContentEncoding encoding) {
+    if (encoding == ContentEncoding::Identity || etag.size() < 2) {
+        return etag;
+    }
+    return etag.substr(0, etag.size() - 1) + "-" + contentEncodingName(encoding) + "\"";
+}
+
+#endif // CONTENTENCODING_H
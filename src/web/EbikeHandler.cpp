@@ -0,0 +1,463 @@
+#include "EbikeHandler.h"
+#include "Logger.h"
+#include "Numbers.h"
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/URI.h>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+namespace web {
+
+namespace {
+    // Parse the bbox=minLon,minLat,maxLon,maxLat and status= query parameters
+    bool parseFleetFilter(const Poco::URI::QueryParameters& params, FleetFilter& filter) {
+        for (const auto& param : params) {
+            if (param.first == "bbox") {
+                double values[4];
+                const char* value = param.second.data();
+                const char* end = value + param.second.size();
+                for (int i = 0; i < 4; ++i) {
+                    const char* next = Numbers::parse(value, end, values[i]);
+                    bool last = i == 3;
+                    if (!next || (last ? next != end : (next == end || *next != ','))) {
+                        return false;
+                    }
+                    value = next + 1;
+                }
+                if (!isValidPosition(values[1], values[0]) || !isValidPosition(values[3], values[2])) {
+                    return false;
+                }
+                filter.hasBox = true;
+                filter.minLon = values[0];
+                filter.minLat = values[1];
+                filter.maxLon = values[2];
+                filter.maxLat = values[3];
+            } else if (param.first == "status") {
+                if (param.second != "locked" && param.second != "unlocked") {
+                    return false;
+                }
+                filter.hasStatus = true;
+                filter.status = statusFromString(param.second);
+            }
+        }
+        return true;
+    }
+
+    // Parse the eBike ID out of /ebikes/{id}/track
+    bool parseTrackPath(const std::string& path, int& id) {
+        const std::string prefix = "/ebikes/";
+        const std::string suffix = "/track";
+        if (path.size() <= prefix.size() + suffix.size() || path.compare(0, prefix.size(), prefix) != 0 ||
+            path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return false;
+        }
+        const char* first = path.data() + prefix.size();
+        const char* last = path.data() + path.size() - suffix.size();
+        return Numbers::parseAll(first, last, id);
+    }
+
+    void sendBadRequest(Poco::Net::HTTPServerResponse& response, const std::string& message) {
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
+        response.send() << message;
+    }
+
+    // Pick the content coding for a request, or answer 406 Not Acceptable
+    // and return false if the client refuses every coding the gateway has
+    bool chooseEncoding(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response,
+                        ContentEncoding& encoding, bool preferIdentity = false) {
+        if (chooseContentEncoding(request.get("Accept-Encoding", ""), encoding, preferIdentity)) {
+            return true;
+        }
+        response.set("Vary", "Accept-Encoding");
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_ACCEPTABLE);
+        response.send() << "No acceptable content coding; gzip, deflate and identity are available";
+        return false;
+    }
+
+    // Send a body in the chosen content coding and count the bytes sent
+    void sendEncoded(Poco::Net::HTTPServerResponse& response, const std::string& body, ContentEncoding encoding,
+                     EndpointMetrics& metrics) {
+        response.set("Vary", "Accept-Encoding");
+        if (encoding != ContentEncoding::Identity) {
+            response.set("Content-Encoding", contentEncodingName(encoding));
+        }
+        response.setContentLength(body.size());
+        response.sendBuffer(body.data(), body.size());
+        metrics.responseBytes.increment(body.size());
+    }
+
+    // Send a per-request JSON body, compressed quickly if it is large
+    // enough for compression to pay off and the client accepts it
+    void sendUncachedJSON(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response,
+                          const std::string& body, EndpointMetrics& metrics) {
+        const size_t minCompressedSize = 1024;
+
+        ContentEncoding encoding;
+        if (!chooseEncoding(request, response, encoding, body.size() < minCompressedSize)) {
+            return;
+        }
+
+        response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
+        response.setContentType("application/json");
+        response.set("Cache-Control", "no-store");
+        if (encoding == ContentEncoding::Identity) {
+            sendEncoded(response, body, encoding, metrics);
+        } else {
+            sendEncoded(response, compressBody(body, encoding, 1), encoding, metrics);
+        }
+    }
+}
+
+// EndpointMetrics
+EndpointMetrics::EndpointMetrics(const std::string& handler)
+    : requests(Metrics::instance().counter("gateway_http_requests_total",
+          "HTTP requests received, by handler", "handler=\"" + handler + "\"")),
+      notModified(Metrics::instance().counter("gateway_http_not_modified_total",
+          "HTTP requests answered with 304 Not Modified, by handler", "handler=\"" + handler + "\"")),
+      badRequests(Metrics::instance().counter("gateway_http_bad_requests_total",
+          "HTTP requests rejected with 400 Bad Request, by handler", "handler=\"" + handler + "\"")),
+      latency(Metrics::instance().histogram("gateway_http_request_seconds",
+          "Time to handle an HTTP request, by handler", "handler=\"" + handler + "\"")),
+      responseBytes(Metrics::instance().counter("gateway_http_response_bytes_total",
+          "HTTP response body bytes sent, after compression, by handler", "handler=\"" + handler + "\"")) {}
+
+// EBikeHandler
+EBikeHandler::EBikeHandler(FleetStore& fleet, FleetSnapshot& snapshot, EndpointMetrics& metrics)
+    : _fleet(fleet), _snapshot(snapshot), _metrics(metrics) {}
+
+void EBikeHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+    Histogram::Timer timer(_metrics.latency);
+
+    Poco::URI::QueryParameters params = Poco::URI(request.getURI()).getQueryParameters();
+
+    // Optional bbox=minLon,minLat,maxLon,maxLat and status=locked|unlocked
+    FleetFilter filter;
+    if (!parseFleetFilter(params, filter)) {
+        _metrics.badRequests.increment();
+        sendBadRequest(response, "Invalid bbox or status parameter");
+        return;
+    }
+
+    // /ebikes?since=<version> returns only the changes after that version
+    for (const auto& param : params) {
+        if (param.first == "since") {
+            uint64_t since;
+            if (!Numbers::parseAll(param.second, since)) {
+                _metrics.badRequests.increment();
+                sendBadRequest(response, "Invalid since parameter");
+                return;
+            }
+
+            uint64_t version;
+            sendUncachedJSON(request, response, _fleet.toGeoJSONDelta(since, filter, version), _metrics);
+            return;
+        }
+    }
+
+    // Filtered views are answered from the spatial index
+    if (!filter.isEmpty()) {
+        uint64_t version;
+        sendUncachedJSON(request, response, _fleet.toGeoJSON(filter, version), _metrics);
+        return;
+    }
+
+    // Get the shared, already serialized GeoJSON FeatureCollection
+    ContentEncoding encoding;
+    if (!chooseEncoding(request, response, encoding)) {
+        return;
+    }
+    std::shared_ptr<const FleetSnapshotData> snapshot = _snapshot.current();
+    std::string etag = encodedETag(snapshot->etag, encoding);
+
+    response.set("ETag", etag);
+    response.set("Cache-Control", "no-cache");
+    response.set("Vary", "Accept-Encoding");
+
+    // The client already has this version
+    if (request.get("If-None-Match", "") == etag) {
+        _metrics.notModified.increment();
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED);
+        response.setContentLength(0);
+        response.send();
+        return;
+    }
+
+    // Compressed once per version and shared by every request for it
+    response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
+    response.setContentType("application/json");
+    sendEncoded(response, snapshot->encodedBody(encoding), encoding, _metrics);
+}
+
+// EBikeStreamHandler
+EBikeStreamHandler::EBikeStreamHandler(FleetStore& fleet, FleetStream& stream, EndpointMetrics& metrics)
+    : _fleet(fleet), _stream(stream), _metrics(metrics),
+      _connections(Metrics::instance().gauge("gateway_sse_connections", "Open /ebikes/stream connections")),
+      _events(Metrics::instance().counter("gateway_sse_events_total", "Fleet change events pushed to streams")) {}
+
+void EBikeStreamHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+
+    // Minimum time between two events, so changes are coalesced per connection
+    const std::chrono::milliseconds minInterval(250);
+    // Idle time after which a comment is sent to detect closed connections
+    const std::chrono::milliseconds keepAlive(15000);
+
+    FleetFilter filter;
+    if (!parseFleetFilter(Poco::URI(request.getURI()).getQueryParameters(), filter)) {
+        _metrics.badRequests.increment();
+        sendBadRequest(response, "Invalid bbox or status parameter");
+        return;
+    }
+
+    // Streams stay open, so they are counted as connections rather than timed
+    _connections.add(1);
+    _stream.addViewer();
+    struct ConnectionGuard {
+        Gauge& connections;
+        FleetStream& stream;
+        ~ConnectionGuard() {
+            stream.removeViewer();
+            connections.add(-1);
+        }
+    } guard{_connections, _stream};
+
+    response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
+    response.setContentType("text/event-stream");
+    response.set("Cache-Control", "no-cache");
+    response.setChunkedTransferEncoding(true);
+    std::ostream& out = response.send();
+
+    auto sendEvent = [&](uint64_t id, const std::string& data) {
+        out << "id: " << id << "\ndata: " << data << "\n\n";
+        _events.increment();
+    };
+
+    // A reconnecting EventSource resumes from the last version it received
+    uint64_t version = 0;
+    std::string body;
+    uint64_t lastEventId;
+    if (Numbers::parseAll(request.get("Last-Event-ID", ""), lastEventId)) {
+        body = _fleet.toGeoJSONDelta(lastEventId, filter, version);
+    } else {
+        body = _fleet.toGeoJSON(filter, version);
+    }
+    sendEvent(version, body);
+    out.flush();
+
+    std::vector<FleetStream::Frame> frames;
+    while (out.good()) {
+        std::this_thread::sleep_for(minInterval);
+        if (_stream.waitForChange(version, keepAlive) <= version) {
+            if (!_stream.isRunning()) {
+                break;
+            }
+            out << ": keep-alive\n\n";
+            out.flush();
+            continue;
+        }
+
+        // The frames collected once for every connection, each rendered
+        // through this connection's filter; a connection that fell too far
+        // behind collects its own delta instead
+        if (_stream.framesSince(version, frames)) {
+            for (const auto& frame : frames) {
+                // Only the first frame may start before this connection's version
+                bool exact = frame->delta.since == version;
+                if (filter.isEmpty()) {
+                    sendEvent(frame->delta.version, frame->unfiltered(exact));
+                } else {
+                    sendEvent(frame->delta.version, frame->filtered(filter, exact));
+                }
+                version = frame->delta.version;
+            }
+        } else {
+            body = _fleet.toGeoJSONDelta(version, filter, version);
+            sendEvent(version, body);
+        }
+        out.flush();
+    }
+}
+
+// TrackHandler
+TrackHandler::TrackHandler(FleetHistory& history, int id, EndpointMetrics& metrics)
+    : _history(history), _id(id), _metrics(metrics) {}
+
+void TrackHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+    Histogram::Timer timer(_metrics.latency);
+
+    // Optional from= and to=, in seconds since the epoch
+    int64_t from = 0;
+    int64_t to = INT64_MAX;
+    for (const auto& param : Poco::URI(request.getURI()).getQueryParameters()) {
+        if (param.first != "from" && param.first != "to") {
+            continue;
+        }
+        if (!Numbers::parseAll(param.second, param.first == "from" ? from : to)) {
+            _metrics.badRequests.increment();
+            sendBadRequest(response, "Invalid from or to parameter");
+            return;
+        }
+    }
+
+    std::string body;
+    if (!_history.toGeoJSON(_id, from, to, body)) {
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_FOUND);
+        response.send() << "No track for eBike " << _id;
+        return;
+    }
+    sendUncachedJSON(request, response, body, _metrics);
+}
+
+// GeofenceEventsHandler
+GeofenceEventsHandler::GeofenceEventsHandler(GeofenceEngine& geofences, EndpointMetrics& metrics)
+    : _geofences(geofences), _metrics(metrics) {}
+
+void GeofenceEventsHandler::handleRequest(Poco::Net::HTTPServerRequest& request,
+                                          Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+    Histogram::Timer timer(_metrics.latency);
+
+    // Most events returned by one request; clients page on with since=next
+    const size_t maxLimit = 10000;
+
+    uint64_t since = 0;
+    int bikeId = -1;
+    int fenceId = 0;
+    bool hasFence = false;
+    size_t limit = 1000;
+    for (const auto& param : Poco::URI(request.getURI()).getQueryParameters()) {
+        bool valid = true;
+        if (param.first == "since") {
+            valid = Numbers::parseAll(param.second, since);
+        } else if (param.first == "bike") {
+            valid = Numbers::parseAll(param.second, bikeId);
+        } else if (param.first == "fence") {
+            valid = hasFence = Numbers::parseAll(param.second, fenceId);
+        } else if (param.first == "limit") {
+            valid = Numbers::parseAll(param.second, limit) && limit >= 1 && limit <= maxLimit;
+        }
+        if (!valid) {
+            _metrics.badRequests.increment();
+            sendBadRequest(response, "Invalid " + param.first + " parameter");
+            return;
+        }
+    }
+
+    std::string body = _geofences.toJSON(since, bikeId, fenceId, hasFence, limit);
+    sendUncachedJSON(request, response, body, _metrics);
+}
+
+// MetricsHandler
+MetricsHandler::MetricsHandler(FleetStore& fleet, EndpointMetrics& metrics) : _fleet(fleet), _metrics(metrics) {}
+
+void MetricsHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+    Histogram::Timer timer(_metrics.latency);
+
+    std::string body;
+    body.reserve(16384);
+    Metrics::instance().render(body);
+
+    // Fleet state is read when scraped rather than tracked on every update
+    body += "# HELP gateway_fleet_bikes eBikes currently tracked\n# TYPE gateway_fleet_bikes gauge\n";
+    Metrics::appendSample(body, "gateway_fleet_bikes", "", static_cast<double>(_fleet.size()));
+    body += "# HELP gateway_fleet_version Version of the fleet state\n# TYPE gateway_fleet_version gauge\n";
+    Metrics::appendSample(body, "gateway_fleet_version", "", static_cast<double>(_fleet.version()));
+
+    response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
+    response.setContentType("text/plain; version=0.0.4");
+    response.set("Cache-Control", "no-store");
+    response.setContentLength(body.size());
+    response.sendBuffer(body.data(), body.size());
+    _metrics.responseBytes.increment(body.size());
+}
+
+// FileHandler
+FileHandler::FileHandler(AssetCache& assets, const std::string& filePath, EndpointMetrics& metrics)
+    : _assets(assets), _filePath(filePath), _metrics(metrics) {}
+
+void FileHandler::handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+    _metrics.requests.increment();
+    Histogram::Timer timer(_metrics.latency);
+
+    std::shared_ptr<const Asset> asset;
+    try {
+        asset = _assets.get(_filePath);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Error serving " << _filePath << ": " << e.what());
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_FOUND);
+        response.send() << "File not found";
+        return;
+    }
+
+    ContentEncoding encoding;
+    if (!chooseEncoding(request, response, encoding)) {
+        return;
+    }
+    std::string etag = encodedETag(asset->etag, encoding);
+
+    // Browsers reuse the page for a minute, then revalidate it with the ETag
+    response.set("ETag", etag);
+    response.set("Last-Modified", asset->lastModified);
+    response.set("Cache-Control", "public, max-age=60");
+    response.set("Vary", "Accept-Encoding");
+
+    if (request.get("If-None-Match", "") == etag) {
+        _metrics.notModified.increment();
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED);
+        response.setContentLength(0);
+        response.send();
+        return;
+    }
+
+    response.setStatus(Poco::Net::HTTPResponse::HTTP_OK);
+    response.setContentType(asset->contentType);
+    sendEncoded(response, asset->encodedBody(encoding), encoding, _metrics);
+}
+
+// RequestHandlerFactory
+RequestHandlerFactory::RequestHandlerFactory(FleetStore& fleet, FleetHistory& history, GeofenceEngine& geofences)
+    : _fleet(fleet), _history(history), _geofences(geofences), _snapshot(fleet), _stream(fleet),
+      _ebikesMetrics("ebikes"), _streamMetrics("stream"), _trackMetrics("track"), _geofenceMetrics("geofences"),
+      _metricsMetrics("metrics"), _fileMetrics("file") {}
+
+Poco::Net::HTTPRequestHandler* RequestHandlerFactory::createRequestHandler(const Poco::Net::HTTPServerRequest& request) {
+    std::string path = Poco::URI(request.getURI()).getPath();
+
+    if (path == "/ebikes") {
+        return new EBikeHandler(_fleet, _snapshot, _ebikesMetrics);
+    }
+
+    if (path == "/ebikes/stream") {
+        return new EBikeStreamHandler(_fleet, _stream, _streamMetrics);
+    }
+
+    // /ebikes/{id}/track
+    int id;
+    if (parseTrackPath(path, id)) {
+        return new TrackHandler(_history, id, _trackMetrics);
+    }
+
+    if (path == "/geofences/events") {
+        return new GeofenceEventsHandler(_geofences, _geofenceMetrics);
+    }
+
+    if (path == "/metrics") {
+        return new MetricsHandler(_fleet, _metricsMetrics);
+    }
+
+    if (path == "/" || path == "/map.html") {
+        return new FileHandler(_assets, "src/html/map.html", _fileMetrics);
+    }
+
+    return nullptr;
+}
+
+void RequestHandlerFactory::shutdown() {
+    _stream.stop();
+}
+
+} // namespace web
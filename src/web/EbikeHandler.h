@@ -6,39 +6,130 @@
 
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
 #include <Poco/Net/HTTPRequestHandler.h>
-#include <Poco/JSON/Array.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include "FleetStore.h"
+#include "FleetHistory.h"
+#include "GeofenceEngine.h"
+#include "FleetSnapshot.h"
+#include "FleetStream.h"
+#include "AssetCache.h"
+#include "Metrics.h"
 
+// The gateway's HTTP layer lives in its own namespace: libwebserver, still
+// linked for sim::socket, defines classes with the same names
+namespace web {
+
+// EndpointMetrics: Request counters and latency of one endpoint, registered
+// once by the factory and shared by the handlers it creates
+struct EndpointMetrics {
+    explicit EndpointMetrics(const std::string& handler);
+
+    Counter& requests;
+    Counter& notModified;
+    Counter& badRequests;
+    Histogram& latency;
+    Counter& responseBytes;
+};
 
 // EBikeHandler: Handles requests to the /ebikes endpoint
 class EBikeHandler : public Poco::Net::HTTPRequestHandler {
 public:
-    explicit EBikeHandler(Poco::JSON::Array::Ptr& ebikes);
+    EBikeHandler(FleetStore& fleet, FleetSnapshot& snapshot, EndpointMetrics& metrics);
+    void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
+
+private:
+    FleetStore& _fleet;
+    FleetSnapshot& _snapshot;
+    EndpointMetrics& _metrics;
+};
+
+// EBikeStreamHandler: Pushes fleet changes to /ebikes/stream as Server-Sent Events
+class EBikeStreamHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    EBikeStreamHandler(FleetStore& fleet, FleetStream& stream, EndpointMetrics& metrics);
+    void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
+
+private:
+    FleetStore& _fleet;
+    FleetStream& _stream;
+    EndpointMetrics& _metrics;
+    Gauge& _connections;
+    Counter& _events;
+};
+
+// TrackHandler: Serves /ebikes/{id}/track?from=&to=, the recorded track
+// of one eBike as a GeoJSON LineString
+class TrackHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    TrackHandler(FleetHistory& history, int id, EndpointMetrics& metrics);
     void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
 
 private:
-    Poco::JSON::Array::Ptr& _ebikes;
+    FleetHistory& _history;
+    int _id;
+    EndpointMetrics& _metrics;
 };
 
-// FileHandler: Handles requests for static files (e.g., map.html)
+// GeofenceEventsHandler: Serves /geofences/events?since=&bike=&fence=&limit=,
+// the geofence enter and exit events after a sequence number
+class GeofenceEventsHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    GeofenceEventsHandler(GeofenceEngine& geofences, EndpointMetrics& metrics);
+    void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
+
+private:
+    GeofenceEngine& _geofences;
+    EndpointMetrics& _metrics;
+};
+
+// MetricsHandler: Serves /metrics in the Prometheus text format
+class MetricsHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    MetricsHandler(FleetStore& fleet, EndpointMetrics& metrics);
+    void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
+
+private:
+    FleetStore& _fleet;
+    EndpointMetrics& _metrics;
+};
+
+// FileHandler: Handles requests for static files (e.g., map.html) from the asset cache
 class FileHandler : public Poco::Net::HTTPRequestHandler {
 public:
-    explicit FileHandler(const std::string& filePath);
+    FileHandler(AssetCache& assets, const std::string& filePath, EndpointMetrics& metrics);
     void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) override;
 
 private:
+    AssetCache& _assets;
     std::string _filePath;
+    EndpointMetrics& _metrics;
 };
 
 // RequestHandlerFactory: Maps incoming requests to the appropriate handler
 class RequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
 public:
-    explicit RequestHandlerFactory(Poco::JSON::Array::Ptr& ebikes);
+    RequestHandlerFactory(FleetStore& fleet, FleetHistory& history, GeofenceEngine& geofences);
     Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest& request) override;
 
+    // Release streaming connections so the server can stop
+    void shutdown();
+
 private:
-    Poco::JSON::Array::Ptr& _ebikes;
+    FleetStore& _fleet;
+    FleetHistory& _history;
+    GeofenceEngine& _geofences;
+    FleetSnapshot _snapshot; // Shared by every EBikeHandler this factory creates
+    FleetStream _stream; // Shared by every EBikeStreamHandler this factory creates
+    AssetCache _assets; // Static files, shared by every FileHandler
+    EndpointMetrics _ebikesMetrics;
+    EndpointMetrics _streamMetrics;
+    EndpointMetrics _trackMetrics;
+    EndpointMetrics _geofenceMetrics;
+    EndpointMetrics _metricsMetrics;
+    EndpointMetrics _fileMetrics;
 };
 
+} // namespace web
+
 #endif // EBIKEHANDLER_H
\ No newline at end of file
@@ -0,0 +1,102 @@
+#ifndef FLEETSNAPSHOT_H
+#define FLEETSNAPSHOT_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "FleetStore.h"
+#include "ContentEncoding.h"
+
+// A serialized /ebikes response for one fleet version
+struct FleetSnapshotData {
+    uint64_t version;
+    std::string etag;
+    std::string body;
+
+    // The body in a content coding, compressed by the first request that
+    // asks for it and then shared until the next version
+    const std::string& encodedBody(ContentEncoding encoding) const {
+        if (encoding == ContentEncoding::Identity) {
+            return body;
+        }
+        Encoded& encoded = encoding == ContentEncoding::Gzip ? _gzip : _deflate;
+        std::call_once(encoded.once, [&] { encoded.body = compressBody(body, encoding); });
+        return encoded.body;
+    }
+
+private:
+    struct Encoded {
+        std::once_flag once;
+        std::string body;
+    };
+
+    mutable Encoded _gzip;
+    mutable Encoded _deflate;
+};
+
+// FleetSnapshot: Shares one serialized copy of the fleet between all
+// concurrent /ebikes requests. The snapshot is rebuilt when the fleet
+// version changes, but at most once per change window, so a constantly
+// changing fleet is serialized at a bounded rate no matter how many
+// dashboards are polling.
+class FleetSnapshot {
+public:
+    explicit FleetSnapshot(FleetStore& fleet,
+                           std::chrono::milliseconds changeWindow = std::chrono::milliseconds(500))
+        : _fleet(fleet), _changeWindow(changeWindow) {
+        // Prefix ETags with the start time so they never match across restarts
+        _etagPrefix = "\"" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count()) + "-";
+    }
+
+    FleetSnapshot(const FleetSnapshot&) = delete;
+    FleetSnapshot& operator=(const FleetSnapshot&) = delete;
+
+    // Get the current snapshot, rebuilding it if it is out of date
+    std::shared_ptr<const FleetSnapshotData> current() {
+        std::shared_ptr<const FleetSnapshotData> snapshot = std::atomic_load(&_snapshot);
+        auto now = std::chrono::steady_clock::now();
+
+        if (snapshot && (snapshot->version == _fleet.version() || now - _builtAt.load() < _changeWindow)) {
+            return snapshot;
+        }
+
+        // Only one request rebuilds; the others keep serving the previous snapshot
+        std::unique_lock<std::mutex> lock(_rebuildMutex, std::defer_lock);
+        if (snapshot) {
+            if (!lock.try_lock()) {
+                return snapshot;
+            }
+        } else {
+            lock.lock();
+        }
+
+        // Another request may have rebuilt while we waited for the lock
+        snapshot = std::atomic_load(&_snapshot);
+        if (snapshot && snapshot->version == _fleet.version()) {
+            return snapshot;
+        }
+
+        auto rebuilt = std::make_shared<FleetSnapshotData>();
+        rebuilt->body = _fleet.toGeoJSON(rebuilt->version);
+        rebuilt->etag = _etagPrefix + std::to_string(rebuilt->version) + "\"";
+
+        snapshot = rebuilt;
+        std::atomic_store(&_snapshot, snapshot);
+        _builtAt = std::chrono::steady_clock::now();
+        return snapshot;
+    }
+
+private:
+    FleetStore& _fleet;
+    std::chrono::milliseconds _changeWindow;
+    std::string _etagPrefix;
+    std::shared_ptr<const FleetSnapshotData> _snapshot;
+    std::atomic<std::chrono::steady_clock::time_point> _builtAt{std::chrono::steady_clock::time_point()};
+    std::mutex _rebuildMutex;
+};
+
+#endif // FLEETSNAPSHOT_H
@@ -0,0 +1,183 @@
+#ifndef FLEETSTREAM_H
+#define FLEETSTREAM_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "FleetStore.h"
+
+// The fleet changes between two consecutive stream versions
+struct FleetStreamFrame {
+    FleetDelta delta;
+
+    // The frame for unfiltered viewers, rendered once and shared
+    const std::string& unfiltered(bool exact) const {
+        Rendered& rendered = exact ? _exact : _inBetween;
+        std::call_once(rendered.once, [&] { FleetStore::appendDelta(rendered.body, delta, FleetFilter(), exact); });
+        return rendered.body;
+    }
+
+    // The frame as seen through a filter by a viewer at delta.since (exact)
+    // or somewhere up to delta.version
+    std::string filtered(const FleetFilter& filter, bool exact) const {
+        std::string body;
+        FleetStore::appendDelta(body, delta, filter, exact);
+        return body;
+    }
+
+private:
+    struct Rendered {
+        std::once_flag once;
+        std::string body;
+    };
+
+    mutable Rendered _exact;
+    mutable Rendered _inBetween;
+};
+
+// FleetStream: Feeds streaming connections the changes to the fleet.
+// A single ticker thread collects the changes since its last tick once,
+// as a frame, and wakes the waiting connections, which render the frames
+// they have not seen through their own filter without touching the fleet.
+// However many viewers are connected, the fleet is only locked once per
+// tick, the ingest path never touches connection state and a slow client
+// can never hold up an update.
+class FleetStream {
+public:
+    typedef std::shared_ptr<const FleetStreamFrame> Frame;
+
+    // Frames kept for connections that fall behind; one further behind
+    // collects its own delta from the fleet
+    static const size_t MaxFrames = 64;
+
+    explicit FleetStream(FleetStore& fleet,
+                         std::chrono::milliseconds tick = std::chrono::milliseconds(100))
+        : _fleet(fleet), _tick(tick), _running(true), _viewers(0), _version(fleet.version()) {
+        _tickerThread = std::thread(&FleetStream::tickerLoop, this);
+    }
+
+    ~FleetStream() {
+        stop();
+    }
+
+    FleetStream(const FleetStream&) = delete;
+    FleetStream& operator=(const FleetStream&) = delete;
+
+    // Count a connection; frames are only collected while there are any
+    void addViewer() {
+        _viewers.fetch_add(1);
+    }
+
+    void removeViewer() {
+        _viewers.fetch_sub(1);
+    }
+
+    // Block until the stream moves past the version already seen, the
+    // timeout expires or the stream is stopped. Returns the latest version.
+    uint64_t waitForChange(uint64_t seen, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _changed.wait_for(lock, timeout, [&] { return _version > seen || !_running; });
+        return _version;
+    }
+
+    // The frames taking a viewer at a version to the latest one, oldest
+    // first; returns false if they are no longer all kept
+    bool framesSince(uint64_t version, std::vector<Frame>& frames) const {
+        frames.clear();
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto first = _frames.begin();
+        while (first != _frames.end() && (*first)->delta.version <= version) {
+            ++first;
+        }
+        if (first == _frames.end()) {
+            // Nothing newer yet, unless the frames were restarted past it
+            return version >= _version;
+        }
+        if ((*first)->delta.since > version) {
+            return false;
+        }
+        frames.assign(first, _frames.end());
+        return true;
+    }
+
+    bool isRunning() const {
+        return _running;
+    }
+
+    // Stop the ticker and release every waiting connection
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_running) {
+                return;
+            }
+            _running = false;
+        }
+        _changed.notify_all();
+
+        if (_tickerThread.joinable()) {
+            _tickerThread.join();
+        }
+    }
+
+private:
+    FleetStore& _fleet;
+    std::chrono::milliseconds _tick;
+    std::atomic<bool> _running;
+    std::atomic<int> _viewers;
+    uint64_t _version; // Version of the latest frame; guarded by _mutex
+    std::deque<Frame> _frames; // Consecutive frames, oldest first; guarded by _mutex
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    std::thread _tickerThread;
+
+    void tickerLoop() {
+        while (_running) {
+            std::this_thread::sleep_for(_tick);
+
+            uint64_t since;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                since = _version;
+            }
+            if (_fleet.version() == since) {
+                continue;
+            }
+
+            // With nobody watching, or too far behind, restart the frames
+            // from the current version
+            std::shared_ptr<FleetStreamFrame> frame;
+            uint64_t version;
+            if (_viewers.load() > 0) {
+                frame = std::make_shared<FleetStreamFrame>();
+                if (!_fleet.changesSince(since, frame->delta)) {
+                    frame.reset();
+                }
+            }
+            version = frame ? frame->delta.version : _fleet.version();
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (frame) {
+                    _frames.push_back(frame);
+                    if (_frames.size() > MaxFrames) {
+                        _frames.pop_front();
+                    }
+                } else {
+                    _frames.clear();
+                }
+                _version = version;
+            }
+            _changed.notify_all();
+        }
+    }
+};
+
+#endif // FLEETSTREAM_H
@@ -0,0 +1,54 @@
+#include "WebServer.h"
+#include "Logger.h"
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/ThreadPool.h>
+#include <atomic>
+#include <csignal>
+#include <thread>
+#include <chrono>
+
+namespace web {
+
+namespace {
+    std::atomic<bool> terminationRequested(false);
+
+    void onTerminationSignal(int) {
+        terminationRequested = true;
+    }
+}
+
+WebServer::WebServer(FleetStore& fleet, FleetHistory& history, GeofenceEngine& geofences) : _fleet(fleet), _history(history), _geofences(geofences) {}
+
+// Start the HTTP server and block until SIGINT or SIGTERM is received
+void WebServer::start(int port) {
+    // Every /ebikes/stream viewer holds a connection thread for its lifetime
+    const int maxConnections = 4096;
+
+    Poco::Net::ServerSocket socket(port);
+    Poco::Net::HTTPServerParams* params = new Poco::Net::HTTPServerParams;
+    params->setMaxThreads(maxConnections);
+    params->setMaxQueued(maxConnections);
+
+    Poco::ThreadPool threadPool(16, maxConnections);
+    RequestHandlerFactory* factory = new RequestHandlerFactory(_fleet, _history, _geofences);
+    Poco::Net::HTTPServer server(factory, threadPool, socket, params);
+
+    std::signal(SIGINT, onTerminationSignal);
+    std::signal(SIGTERM, onTerminationSignal);
+
+    server.start();
+    LOG_INFO("Web server started on port " << port);
+
+    while (!terminationRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    // Release streaming connections before waiting for the server to stop
+    factory->shutdown();
+    server.stopAll(true);
+    LOG_INFO("Web server stopped");
+}
+
+} // namespace web
@@ -3,16 +3,24 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
-#include <Poco/JSON/Array.h>
+#include "FleetStore.h"
+#include "FleetHistory.h"
+#include "GeofenceEngine.h"
 #include "EbikeHandler.h"
 
+namespace web {
+
 class WebServer {
 public:
-    WebServer(Poco::JSON::Array::Ptr& ebikes);
+    WebServer(FleetStore& fleet, FleetHistory& history, GeofenceEngine& geofences);
     void start(int port);
 
 private:
-    Poco::JSON::Array::Ptr& _ebikes;
+    FleetStore& _fleet;
+    FleetHistory& _history;
+    GeofenceEngine& _geofences;
 };
 
+} // namespace web
+
 #endif // WEBSERVER_H
\ No newline at end of file